@@ -0,0 +1,102 @@
+/*
+bench_encode.c - Encoding throughput of WS2812FX_output.c on the host.
+
+Encodes whole frames of 1000 pixels through the memory backend and the
+SPI bit patterns, plain, dithered and with white extraction, and prints
+the time per frame. Not run by ctest, start it by hand:
+
+	./bench_encode [frames]
+
+LICENSE
+The MIT License (MIT), see WS2812FX.h
+*/
+
+#include "WS2812FX_output.h"
+#include "WS2812FX_math.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define PIXELS 1000
+
+/*
+* The SPI backend without the SPI driver: frames are only encoded.
+*/
+static void *spiOpen(const ws2812fx_output_config_t *config) {
+	ws2812fx_output_config_t *copy = malloc(sizeof(ws2812fx_output_config_t));
+	if (copy) {
+		*copy = *config;
+	}
+	return copy;
+}
+
+static void *spiAlloc(void *output) {
+	const ws2812fx_output_config_t *config = output;
+	return calloc(config->length * config->bytes_per_pixel, WS2812FX_SPI_BITS_PER_BIT);
+}
+
+static void spiEncodeFrame(void *output, void *buffer, uint32_t offset, const uint8_t *bytes, uint32_t count) {
+	(void)output;
+	WS2812FX_spiEncode((uint8_t *)buffer + (offset * WS2812FX_SPI_BITS_PER_BIT), bytes, count);
+}
+
+static const ws2812fx_backend_t spi_encoder = {
+	.name = "spi",
+	.open = spiOpen,
+	.alloc = spiAlloc,
+	.encode = spiEncodeFrame
+};
+
+static double now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + (ts.tv_nsec / 1e9);
+}
+
+static void bench(const ws2812fx_backend_t *backend, uint8_t bytes_per_pixel, bool dither, bool white_extraction,
+		const uint32_t *colors, int frames) {
+	const ws2812fx_output_config_t config = {
+		.length = PIXELS,
+		.bytes_per_pixel = bytes_per_pixel
+	};
+	void *output = backend->open(&config);
+	void *buffer = backend->alloc(output);
+	ws2812fx_encoder_t encoder;
+
+	WS2812FX_encoderInit(&encoder, WS2812FX_ORDER_GRB, bytes_per_pixel);
+	WS2812FX_buildGammaTable(&encoder, 2.2);
+	WS2812FX_buildOutputTable(&encoder, 180);
+	encoder.white_extraction = white_extraction;
+
+	double start = now();
+	for (int f = 0; f < frames; f++) {
+		uint8_t threshold = dither ? WS2812FX_nextDither(&encoder) : 0;
+		WS2812FX_encode(&encoder, backend, output, buffer, colors, 0, PIXELS, threshold);
+	}
+	double us = (now() - start) * 1e6 / frames;
+
+	printf("%-6s %-4s %-6s %-16s %8.1f us/frame %8.1f Mpixel/s\n", backend->name, (bytes_per_pixel == 4) ? "RGBW" : "RGB",
+		dither ? "dither" : "", white_extraction ? "white extraction" : "", us, PIXELS / us);
+
+	free(buffer);
+	free(output);
+}
+
+int main(int argc, char **argv) {
+	int frames = (argc > 1) ? atoi(argv[1]) : 2000;
+	static uint32_t colors[PIXELS];
+	ws2812fx_random_t rng = { 0x2545F491 };
+
+	for (int i = 0; i < PIXELS; i++) {
+		colors[i] = WS2812FX_random32(&rng);
+	}
+
+	const ws2812fx_backend_t *backends[] = { &WS2812FX_BACKEND_MEMORY, &spi_encoder };
+	for (unsigned int b = 0; b < sizeof(backends) / sizeof(backends[0]); b++) {
+		bench(backends[b], 3, false, false, colors, frames);
+		bench(backends[b], 3, true, false, colors, frames);
+		bench(backends[b], 4, false, true, colors, frames);
+	}
+	return 0;
+}
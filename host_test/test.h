@@ -0,0 +1,26 @@
+/*
+test.h - Minimal checks for the WS2812FX host tests.
+
+LICENSE
+The MIT License (MIT), see WS2812FX.h
+*/
+
+#ifndef WS2812FX_test_h
+#define WS2812FX_test_h
+
+#include <stdio.h>
+
+static int test_failures = 0;
+
+#define CHECK(cond, ...) do { \
+	if (!(cond)) { \
+		test_failures++; \
+		fprintf(stderr, "%s:%d: %s failed: ", __FILE__, __LINE__, #cond); \
+		fprintf(stderr, __VA_ARGS__); \
+		fprintf(stderr, "\n"); \
+	} \
+} while (0)
+
+#define TEST_RESULT() (test_failures ? (fprintf(stderr, "%d checks failed\n", test_failures), 1) : 0)
+
+#endif
@@ -0,0 +1,127 @@
+/*
+test_math.c - Checks the span kernels of WS2812FX_math.c against the
+per pixel formulas they implement, over random pixels and every length
+up to a few vector widths, so the tails are covered as well.
+
+LICENSE
+The MIT License (MIT), see WS2812FX.h
+*/
+
+#include "WS2812FX_math.h"
+#include "test.h"
+
+#include <string.h>
+
+#define MAX_LENGTH 37
+#define ROUNDS 200
+
+static ws2812fx_random_t rng = { 0x12345678 };
+
+static void randomPixels(uint32_t *px, uint16_t len) {
+	for (uint16_t i = 0; i < len; i++) {
+		px[i] = WS2812FX_random32(&rng);
+	}
+}
+
+/*
+* Reference diffusion, every pixel from the values before the sweep.
+*/
+static void diffuseReference(const uint32_t *in, uint32_t *out, uint16_t len, uint8_t keep, uint8_t seep) {
+	for (uint16_t i = 0; i < len; i++) {
+		uint32_t left = (i > 0) ? in[i - 1] : 0;
+		uint32_t right = (i + 1 < len) ? in[i + 1] : 0;
+		out[i] = WS2812FX_scale32(in[i], keep) + WS2812FX_scale32(left, seep) + WS2812FX_scale32(right, seep);
+	}
+}
+
+static void testFade(void) {
+	uint32_t px[MAX_LENGTH], in[MAX_LENGTH];
+
+	for (int round = 0; round < ROUNDS; round++) {
+		for (uint16_t len = 0; len <= MAX_LENGTH; len++) {
+			uint8_t scale = WS2812FX_random32(&rng);
+			randomPixels(in, len);
+			memcpy(px, in, sizeof(px));
+			WS2812FX_fadeSpan(px, len, scale);
+			for (uint16_t i = 0; i < len; i++) {
+				CHECK(px[i] == WS2812FX_scale32(in[i], scale), "fade len %d pixel %d", len, i);
+			}
+		}
+	}
+}
+
+static void testAdd(void) {
+	uint32_t dst[MAX_LENGTH], src[MAX_LENGTH], in[MAX_LENGTH];
+
+	for (int round = 0; round < ROUNDS; round++) {
+		for (uint16_t len = 0; len <= MAX_LENGTH; len++) {
+			randomPixels(in, len);
+			randomPixels(src, len);
+			memcpy(dst, in, sizeof(dst));
+			WS2812FX_addSpan(dst, src, len);
+			for (uint16_t i = 0; i < len; i++) {
+				CHECK(dst[i] == WS2812FX_qadd32(in[i], src[i]), "add len %d pixel %d", len, i);
+			}
+		}
+	}
+}
+
+/*
+* Saturating add per channel, checks qadd32 itself.
+*/
+static void testQadd(void) {
+	for (int round = 0; round < 100000; round++) {
+		uint32_t a = WS2812FX_random32(&rng);
+		uint32_t b = WS2812FX_random32(&rng);
+		uint32_t expected = 0;
+		for (int shift = 0; shift < 32; shift += 8) {
+			uint32_t sum = ((a >> shift) & 0xFF) + ((b >> shift) & 0xFF);
+			expected |= ((sum > 255) ? 255 : sum) << shift;
+		}
+		CHECK(WS2812FX_qadd32(a, b) == expected, "qadd %08x + %08x", (unsigned)a, (unsigned)b);
+	}
+}
+
+static void testDiffuse(void) {
+	uint32_t px[MAX_LENGTH], in[MAX_LENGTH], expected[MAX_LENGTH];
+
+	for (int round = 0; round < ROUNDS; round++) {
+		for (uint16_t len = 0; len <= MAX_LENGTH; len++) {
+			uint8_t seep = WS2812FX_random32(&rng) % 65;
+			uint8_t keep = 256 - (2 * seep) - (WS2812FX_random32(&rng) % 16);
+			randomPixels(in, len);
+			memcpy(px, in, sizeof(px));
+			WS2812FX_diffuseSpan(px, len, keep, seep);
+			diffuseReference(in, expected, len, keep, seep);
+			for (uint16_t i = 0; i < len; i++) {
+				CHECK(px[i] == expected[i], "diffuse len %d pixel %d keep %d seep %d", len, i, keep, seep);
+			}
+		}
+	}
+}
+
+static void testBlur(void) {
+	uint32_t px[MAX_LENGTH], in[MAX_LENGTH], expected[MAX_LENGTH];
+
+	for (int round = 0; round < ROUNDS; round++) {
+		for (uint16_t len = 0; len <= MAX_LENGTH; len++) {
+			uint8_t amount = WS2812FX_random32(&rng);
+			randomPixels(in, len);
+			memcpy(px, in, sizeof(px));
+			WS2812FX_blurSpan(px, len, amount);
+			diffuseReference(in, expected, len, 255 - amount, amount >> 1);
+			for (uint16_t i = 0; i < len; i++) {
+				CHECK(px[i] == expected[i], "blur len %d pixel %d amount %d", len, i, amount);
+			}
+		}
+	}
+}
+
+int main(void) {
+	testQadd();
+	testFade();
+	testAdd();
+	testDiffuse();
+	testBlur();
+	return TEST_RESULT();
+}
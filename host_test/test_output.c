@@ -0,0 +1,167 @@
+/*
+test_output.c - Checks the wire order encoder and the memory and SPI
+encoding of WS2812FX_output.c.
+
+LICENSE
+The MIT License (MIT), see WS2812FX.h
+*/
+
+#include "WS2812FX_output.h"
+#include "test.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define LENGTH 45
+
+static uint8_t latched_count = 0;
+
+static void latched(void *arg) {
+	(void)arg;
+	latched_count++;
+}
+
+/*
+* Encodes colors with the memory backend and returns the latched bytes.
+*/
+static const uint8_t *encodeFrame(ws2812fx_encoder_t *encoder, const uint32_t *colors, uint8_t threshold, bool *fractional) {
+	static ws2812fx_memory_output_t *output = NULL;
+	static void *buffer = NULL;
+	const ws2812fx_output_config_t config = {
+		.length = LENGTH,
+		.bytes_per_pixel = encoder->bytes_per_pixel,
+		.done = latched
+	};
+
+	if (output) {
+		free(buffer);
+		WS2812FX_BACKEND_MEMORY.close(output);
+	}
+	output = WS2812FX_BACKEND_MEMORY.open(&config);
+	buffer = WS2812FX_BACKEND_MEMORY.alloc(output);
+	*fractional = WS2812FX_encode(encoder, &WS2812FX_BACKEND_MEMORY, output, buffer, colors, 0, LENGTH, threshold);
+	CHECK(WS2812FX_BACKEND_MEMORY.send(output, buffer), "memory send");
+	return output->latched;
+}
+
+/*
+* With gamma 1 and full brightness every byte goes out unchanged, in the
+* color order of the strip.
+*/
+static void testColorOrder(void) {
+	static const struct {
+		ws2812fx_color_order_t order;
+		uint8_t bytes[3];			// of 0x112233
+	} orders[] = {
+		{ WS2812FX_ORDER_GRB, { 0x22, 0x11, 0x33 } },
+		{ WS2812FX_ORDER_RGB, { 0x11, 0x22, 0x33 } },
+		{ WS2812FX_ORDER_BRG, { 0x33, 0x11, 0x22 } },
+		{ WS2812FX_ORDER_RBG, { 0x11, 0x33, 0x22 } },
+		{ WS2812FX_ORDER_GBR, { 0x22, 0x33, 0x11 } },
+		{ WS2812FX_ORDER_BGR, { 0x33, 0x22, 0x11 } },
+	};
+	uint32_t colors[LENGTH];
+	ws2812fx_encoder_t encoder;
+	bool fractional;
+
+	for (int i = 0; i < LENGTH; i++) {
+		colors[i] = 0x112233;
+	}
+	for (unsigned int o = 0; o < sizeof(orders) / sizeof(orders[0]); o++) {
+		WS2812FX_encoderInit(&encoder, orders[o].order, 3);
+		WS2812FX_buildGammaTable(&encoder, 1.0);
+		WS2812FX_buildOutputTable(&encoder, 255);
+		CHECK(!encoder.fractional, "order %d: fractional table at full brightness", orders[o].order);
+
+		const uint8_t *bytes = encodeFrame(&encoder, colors, 0, &fractional);
+		CHECK(!fractional, "order %d: fractional frame", orders[o].order);
+		for (int i = 0; i < LENGTH; i++) {
+			CHECK(memcmp(&bytes[i * 3], orders[o].bytes, 3) == 0, "order %d pixel %d", orders[o].order, i);
+		}
+	}
+}
+
+/*
+* The part the three colors have in common moves to the white byte.
+*/
+static void testWhiteExtraction(void) {
+	uint32_t colors[LENGTH];
+	ws2812fx_encoder_t encoder;
+	bool fractional;
+
+	for (int i = 0; i < LENGTH; i++) {
+		colors[i] = 0xF0203040;
+	}
+	WS2812FX_encoderInit(&encoder, WS2812FX_ORDER_GRB, 4);
+	WS2812FX_buildGammaTable(&encoder, 1.0);
+	WS2812FX_buildOutputTable(&encoder, 255);
+
+	const uint8_t *bytes = encodeFrame(&encoder, colors, 0, &fractional);
+	static const uint8_t plain[] = { 0x30, 0x20, 0x40, 0xF0 };
+	CHECK(memcmp(bytes, plain, 4) == 0 && memcmp(&bytes[(LENGTH - 1) * 4], plain, 4) == 0, "RGBW without extraction");
+
+	encoder.white_extraction = true;
+	bytes = encodeFrame(&encoder, colors, 0, &fractional);
+	static const uint8_t extracted[] = { 0x10, 0x00, 0x20, 0xFF };	// white saturates
+	CHECK(memcmp(bytes, extracted, 4) == 0 && memcmp(&bytes[(LENGTH - 1) * 4], extracted, 4) == 0, "RGBW with extraction");
+}
+
+/*
+* Over all eight dither phases the average output matches the 8.8 fixed
+* point level of the table.
+*/
+static void testDither(void) {
+	uint32_t colors[LENGTH];
+	uint32_t sums[LENGTH * 3] = { 0 };
+	ws2812fx_encoder_t encoder;
+	bool fractional;
+
+	for (int i = 0; i < LENGTH; i++) {
+		colors[i] = (i * 0x050301) & 0xFFFFFF;
+	}
+	WS2812FX_encoderInit(&encoder, WS2812FX_ORDER_RGB, 3);
+	WS2812FX_buildGammaTable(&encoder, 2.2);
+	WS2812FX_buildOutputTable(&encoder, 100);
+	CHECK(encoder.fractional, "no fractional levels at brightness 100");
+
+	for (int phase = 0; phase < 8; phase++) {
+		const uint8_t *bytes = encodeFrame(&encoder, colors, WS2812FX_nextDither(&encoder), &fractional);
+		CHECK(fractional, "phase %d not fractional", phase);
+		for (int i = 0; i < LENGTH * 3; i++) {
+			sums[i] += bytes[i];
+		}
+	}
+	for (int i = 0; i < LENGTH; i++) {
+		for (int c = 0; c < 3; c++) {
+			uint16_t level = encoder.table[(colors[i] >> (16 - (c * 8))) & 0xFF];
+			int error = (int)(sums[(i * 3) + c] * 32) - level;
+			CHECK(error >= -32 && error <= 32, "pixel %d channel %d: average %u/8, level %u", i, c, (unsigned)sums[(i * 3) + c], level);
+		}
+	}
+}
+
+/*
+* Every bit becomes 100 or 110, MSB first.
+*/
+static void testSpiEncode(void) {
+	for (uint16_t v = 0; v < 256; v++) {
+		uint8_t byte = v;
+		uint8_t out[WS2812FX_SPI_BITS_PER_BIT];
+		WS2812FX_spiEncode(out, &byte, 1);
+
+		uint32_t code = ((uint32_t)out[0] << 16) | ((uint32_t)out[1] << 8) | out[2];
+		for (int bit = 7; bit >= 0; bit--) {
+			uint8_t pattern = (code >> (bit * 3)) & 7;
+			CHECK(pattern == (((v >> bit) & 1) ? 6 : 4), "byte %02x bit %d", v, bit);
+		}
+	}
+}
+
+int main(void) {
+	testColorOrder();
+	testWhiteExtraction();
+	testDither();
+	testSpiEncode();
+	CHECK(latched_count > 0, "memory backend never latched");
+	return TEST_RESULT();
+}
@@ -0,0 +1,178 @@
+/*
+test_queue.c - Checks the command queues of WS2812FX_queue.c: order,
+full queue rejection, index wrap-around at 2^32 and several producers
+pushing into the multi-producer queue at once.
+
+LICENSE
+The MIT License (MIT), see WS2812FX.h
+*/
+
+#include "WS2812FX_queue.h"
+#include "test.h"
+
+#include <limits.h>
+#include <pthread.h>
+
+#define QUEUE_MASK (WS2812FX_QUEUE_LENGTH - 1)
+#define PRODUCERS 3
+#define PRODUCER_COMMANDS 200000
+
+static ws2812fx_command_t command(uint32_t value) {
+	ws2812fx_command_t c = { .type = (uint8_t)value, .value = value };
+	return c;
+}
+
+/*
+* Starts both queues at index start, as if start commands had been pushed
+* and popped, to run their indices across the 2^32 wrap.
+*/
+static void spscStart(ws2812fx_spsc_queue_t *queue, unsigned int start) {
+	WS2812FX_spscInit(queue);
+	atomic_store(&queue->head, start);
+	atomic_store(&queue->tail, start);
+}
+
+static void mpscStart(ws2812fx_mpsc_queue_t *queue, unsigned int start) {
+	WS2812FX_mpscInit(queue);
+	for (unsigned int i = 0; i < WS2812FX_QUEUE_LENGTH; i++) {
+		unsigned int pos = start + ((i - start) & QUEUE_MASK);
+		atomic_store(&queue->slots[i].sequence, pos & ~QUEUE_MASK);
+	}
+	atomic_store(&queue->head, start);
+	queue->tail = start;
+}
+
+static void testSpsc(unsigned int start) {
+	ws2812fx_spsc_queue_t queue;
+	ws2812fx_command_t c = command(0), out;
+	uint32_t pushed = 0, popped = 0;
+
+	spscStart(&queue, start);
+	CHECK(!WS2812FX_spscPop(&queue, &out), "pop from an empty queue at %u", start);
+
+	// fill, reject, drain, several laps with a varying fill level
+	for (int lap = 0; lap < 8; lap++) {
+		for (int i = 0; i < WS2812FX_QUEUE_LENGTH; i++) {
+			c = command(pushed++);
+			CHECK(WS2812FX_spscPush(&queue, &c), "push %u at %u", (unsigned)c.value, start);
+		}
+		c = command(pushed);
+		CHECK(!WS2812FX_spscPush(&queue, &c), "push into a full queue at %u", start);
+
+		for (int i = 0; i < WS2812FX_QUEUE_LENGTH - lap; i++) {
+			CHECK(WS2812FX_spscPop(&queue, &out) && out.value == popped, "pop %u at %u", (unsigned)popped, start);
+			popped++;
+		}
+		for (int i = 0; i < WS2812FX_QUEUE_LENGTH - lap; i++) {
+			c = command(pushed++);
+			CHECK(WS2812FX_spscPush(&queue, &c), "refill %u at %u", (unsigned)c.value, start);
+		}
+		while (WS2812FX_spscPop(&queue, &out)) {
+			CHECK(out.value == popped, "drain got %u, expected %u at %u", (unsigned)out.value, (unsigned)popped, start);
+			popped++;
+		}
+		CHECK(popped == pushed, "drained %u of %u at %u", (unsigned)popped, (unsigned)pushed, start);
+	}
+}
+
+static void testMpsc(unsigned int start) {
+	ws2812fx_mpsc_queue_t queue;
+	ws2812fx_command_t c, out;
+	uint32_t pushed = 0, popped = 0;
+
+	mpscStart(&queue, start);
+	CHECK(!WS2812FX_mpscPop(&queue, &out), "pop from an empty queue at %u", start);
+
+	for (int lap = 0; lap < 8; lap++) {
+		for (int i = 0; i < WS2812FX_QUEUE_LENGTH; i++) {
+			c = command(pushed++);
+			CHECK(WS2812FX_mpscPush(&queue, &c), "push %u at %u", (unsigned)c.value, start);
+		}
+		c = command(pushed);
+		CHECK(!WS2812FX_mpscPush(&queue, &c), "push into a full queue at %u", start);
+
+		// free a few slots, they take exactly that many pushes
+		for (int i = 0; i <= lap; i++) {
+			CHECK(WS2812FX_mpscPop(&queue, &out) && out.value == popped, "pop %u at %u", (unsigned)popped, start);
+			popped++;
+		}
+		for (int i = 0; i <= lap; i++) {
+			c = command(pushed++);
+			CHECK(WS2812FX_mpscPush(&queue, &c), "refill %u at %u", (unsigned)c.value, start);
+		}
+		c = command(pushed);
+		CHECK(!WS2812FX_mpscPush(&queue, &c), "push into a refilled queue at %u", start);
+
+		while (WS2812FX_mpscPop(&queue, &out)) {
+			CHECK(out.value == popped, "drain got %u, expected %u at %u", (unsigned)out.value, (unsigned)popped, start);
+			popped++;
+		}
+		CHECK(popped == pushed, "drained %u of %u at %u", (unsigned)popped, (unsigned)pushed, start);
+	}
+}
+
+static ws2812fx_mpsc_queue_t _stress_queue;
+
+/*
+* Pushes PRODUCER_COMMANDS commands tagged with the producer in type and
+* a running number in value, retrying while the queue is full.
+*/
+static void *producer(void *arg) {
+	uint8_t id = (uint8_t)(uintptr_t)arg;
+
+	for (uint32_t n = 0; n < PRODUCER_COMMANDS; n++) {
+		ws2812fx_command_t c = { .type = id, .value = n };
+		while (!WS2812FX_mpscPush(&_stress_queue, &c)) {
+			sched_yield();
+		}
+	}
+	return NULL;
+}
+
+/*
+* Several producers against one consumer: nothing is lost or duplicated
+* and the commands of each producer arrive in the order they were pushed.
+*/
+static void testMpscStress(unsigned int start) {
+	pthread_t threads[PRODUCERS];
+	uint32_t next[PRODUCERS] = { 0 };
+	uint32_t received = 0;
+	ws2812fx_command_t out;
+
+	mpscStart(&_stress_queue, start);
+	for (uintptr_t p = 0; p < PRODUCERS; p++) {
+		pthread_create(&threads[p], NULL, producer, (void *)p);
+	}
+
+	while (received < PRODUCERS * PRODUCER_COMMANDS) {
+		if (!WS2812FX_mpscPop(&_stress_queue, &out)) {
+			sched_yield();
+			continue;
+		}
+		received++;
+		if (out.type >= PRODUCERS) {
+			CHECK(out.type < PRODUCERS, "unknown producer %d", out.type);
+			break;
+		}
+		CHECK(out.value == next[out.type], "producer %d sent %u, expected %u",
+			out.type, (unsigned)out.value, (unsigned)next[out.type]);
+		next[out.type] = out.value + 1;
+	}
+
+	for (int p = 0; p < PRODUCERS; p++) {
+		pthread_join(threads[p], NULL);
+	}
+	CHECK(!WS2812FX_mpscPop(&_stress_queue, &out), "queue not empty after %u commands", (unsigned)received);
+}
+
+int main(void) {
+	const unsigned int starts[] = { 0, 5, UINT_MAX - 20, UINT_MAX - 3 };
+
+	for (unsigned int i = 0; i < sizeof(starts) / sizeof(starts[0]); i++) {
+		testSpsc(starts[i]);
+		testMpsc(starts[i]);
+	}
+	testMpscStress(0);
+	testMpscStress(UINT_MAX - (PRODUCER_COMMANDS / 2));
+	return TEST_RESULT();
+}
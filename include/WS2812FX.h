@@ -42,13 +42,54 @@ CHANGELOG
 
 #include <stdlib.h>
 #include <stdbool.h>
-#include "led_strip.h"
+#include "WS2812FX_math.h"
+#include "WS2812FX_output.h"
 
 //#define LED_INBUILT_GPIO 2      // this is the onboard LED used to show on/off only
+//#define WS2812FX_SINGLE_CONTROL_TASK  // all setters are called from one task, use the cheaper SPSC queue
 
 #define DEFAULT_MODE 9
 #define DEFAULT_SPEED 1
 #define DEFAULT_COLOR 0xFF10EE
+#define DEFAULT_SPARK_DENSITY 5
+#define DEFAULT_RANDOM_SEED 0x2545F491
+
+// each instance drives one strip on its own RMT channel
+#ifndef WS2812FX_MAX_INSTANCES
+#define WS2812FX_MAX_INSTANCES 8
+#endif
+
+// ranges of one strip running their own modes, see WS2812FX_setSegment()
+#ifndef WS2812FX_MAX_SEGMENTS
+#define WS2812FX_MAX_SEGMENTS 10
+#endif
+
+// render/transmit pipeline, the render task runs the modes and queues up
+// to WS2812FX_FRAME_QUEUE_DEPTH frames for the transmit task driving the RMT
+#ifndef WS2812FX_FRAME_QUEUE_DEPTH
+#define WS2812FX_FRAME_QUEUE_DEPTH 2
+#endif
+#ifndef WS2812FX_RENDER_CORE
+#define WS2812FX_RENDER_CORE 1
+#endif
+#ifndef WS2812FX_RENDER_PRIORITY
+#define WS2812FX_RENDER_PRIORITY 2
+#endif
+#ifndef WS2812FX_TRANSMIT_CORE
+#define WS2812FX_TRANSMIT_CORE 0
+#endif
+#ifndef WS2812FX_TRANSMIT_PRIORITY
+#define WS2812FX_TRANSMIT_PRIORITY 3
+#endif
+
+// pixel-parallel modes split strips of at least WS2812FX_PARALLEL_MIN_PIXELS
+// between the render task and WS2812FX_RENDER_WORKERS helper tasks
+#ifndef WS2812FX_RENDER_WORKERS
+#define WS2812FX_RENDER_WORKERS 1
+#endif
+#ifndef WS2812FX_PARALLEL_MIN_PIXELS
+#define WS2812FX_PARALLEL_MIN_PIXELS 256
+#endif
 
 #define SPEED_MIN 1
 #define SPEED_MAX 255
@@ -57,7 +98,7 @@ CHANGELOG
 #define BRIGHTNESS_MAX 255
 #define BRIGHTNESS_FILTER 0.9
 
-#define MODE_COUNT 54
+#define MODE_COUNT 57
 
 #define FX_MODE_STATIC                   0
 #define FX_MODE_BLINK                    1
@@ -113,6 +154,12 @@ CHANGELOG
 #define FX_MODE_DUAL_COLOR_WIPE_OUT_IN  51
 #define FX_MODE_CIRCUS_COMBUSTUS        52
 #define FX_MODE_HALLOWEEN               53
+#define FX_MODE_TILE                    54
+#define FX_MODE_COLOR_WAVES             55
+#define FX_MODE_INTERFERENCE            56
+
+#define TILE_COUNT 8
+#define TILE_MAX_LENGTH 16
 
 
 typedef union {
@@ -125,97 +172,200 @@ typedef union {
     uint32_t color; // 0xWWRRGGBB
 } ws2812_pixel_t;
 
-typedef void (*mode)(void);
+typedef enum {
+  PIXEL_RGB = 12,
+  PIXEL_RGBW = 16		// SK6812 RGBW, the white byte follows the colors
+} pixeltype_t;
+
+// one strip, see WS2812FX_init()
+typedef struct {
+	int gpio;
+	uint8_t channel;			// RMT channel or SPI host, depending on the backend
+	uint16_t length;
+	ws2812fx_color_order_t color_order;
+	pixeltype_t pixel_type;
+	const ws2812fx_backend_t *backend;	// NULL for WS2812FX_BACKEND_RMT
+} ws2812fx_config_t;
+
+#define WS2812FX_DEFAULT_CONFIG(pin, output_channel, count) { \
+	.gpio = (pin), \
+	.channel = (output_channel), \
+	.length = (count), \
+	.color_order = WS2812FX_ORDER_GRB, \
+	.pixel_type = PIXEL_RGB, \
+	.backend = NULL \
+}
+
+typedef struct ws2812fx_s ws2812fx_t;
+typedef struct ws2812fx_segment_s ws2812fx_segment_t;
+
+typedef struct {
+	uint64_t elapsed_us;	// since the mode was started or reset
+	uint32_t elapsed_ms;
+	uint32_t delta_us;		// since the previous call, 0 on the first one
+} ws2812fx_time_t;
+
+// a complete scene, see WS2812FX_applyState()
+typedef struct {
+	uint8_t mode;
+	uint8_t speed;
+	uint8_t brightness;
+	uint32_t color;
+} ws2812fx_state_t;
+
+typedef void (*mode)(const ws2812fx_time_t *t);
+
+// part of the strip rendered by one task, see WS2812FX_renderRanges()
+typedef struct {
+	uint16_t first;				// pixels [first, last) to render
+	uint16_t last;
+	uint16_t dirty_first;		// pixels changed by the kernel
+	uint16_t dirty_last;
+	uint32_t arg;				// passed through from WS2812FX_renderRanges()
+	const void *data;
+	ws2812fx_t *fx;				// strip and segment being rendered, kernels run in
+	const ws2812fx_segment_t *seg;	// other tasks and must not use _fx or _seg
+	ws2812fx_random_t random;	// own generator, _random can't be shared between tasks
+} ws2812fx_range_t;
+
+typedef void (*mode_kernel)(const ws2812fx_time_t *t, ws2812fx_range_t *range);
   
+ws2812fx_t
+	*WS2812FX_init(const ws2812fx_config_t *config);
+
 void
-	WS2812FX_init(uint16_t pixel_count),
 	WS2812FX_initModes(void),
 	WS2812FX_service(void *_args),
-	WS2812FX_start(void),
-	WS2812FX_stop(void),
-	WS2812FX_setMode(uint8_t m),
-	WS2812FX_setMode360(float m),
-	WS2812FX_setSpeed(uint8_t s),
-	WS2812FX_setColor(uint8_t r, uint8_t g, uint8_t b),
-	WS2812FX_setColor32(uint32_t c),
-	WS2812FX_setBrightness(uint8_t b),
-	WS2812FX_setInverted(bool inverted),
-	WS2812FX_setSlowStart(bool slow_start),
-	WS2812_clear(void);
+	WS2812FX_start(ws2812fx_t *fx),
+	WS2812FX_stop(ws2812fx_t *fx),
+	WS2812FX_setMode(ws2812fx_t *fx, uint8_t m),
+	WS2812FX_setMode360(ws2812fx_t *fx, float m),
+	WS2812FX_setSpeed(ws2812fx_t *fx, uint8_t s),
+	WS2812FX_setColor(ws2812fx_t *fx, uint8_t r, uint8_t g, uint8_t b),
+	WS2812FX_setColor32(ws2812fx_t *fx, uint32_t c),
+	WS2812FX_setBrightness(ws2812fx_t *fx, uint8_t b),
+	WS2812FX_forceBrightness(ws2812fx_t *fx, uint8_t b),
+	WS2812FX_setInverted(ws2812fx_t *fx, bool inverted),
+	WS2812FX_setSlowStart(ws2812fx_t *fx, bool slow_start),
+	WS2812FX_setGamma(ws2812fx_t *fx, float gamma),
+	WS2812FX_setDither(ws2812fx_t *fx, bool dither),
+	WS2812FX_setWhiteExtraction(ws2812fx_t *fx, bool white_extraction),
+	WS2812FX_setSparkDensity(ws2812fx_t *fx, uint16_t density),
+	WS2812FX_setTile(ws2812fx_t *fx, uint8_t id),
+	WS2812FX_setSeed(ws2812fx_t *fx, uint32_t seed),
+	WS2812FX_setHardwareRandom(ws2812fx_t *fx, bool hardware_random),
+	WS2812FX_applyState(ws2812fx_t *fx, const ws2812fx_state_t *state),
+	WS2812FX_setSegment(ws2812fx_t *fx, uint8_t id, uint16_t start, uint16_t stop, uint8_t mode, uint32_t color, uint8_t speed, bool reverse),
+	WS2812FX_resetSegments(ws2812fx_t *fx);
 
 bool
-	WS2812FX_isRunning(void);
+	WS2812FX_isRunning(ws2812fx_t *fx);
+
+int8_t
+	WS2812FX_addTile(const uint32_t *colors, uint8_t length);
 
 uint8_t
-	WS2812FX_getMode(void),
-	WS2812FX_getSpeed(void),
-	WS2812FX_getBrightness(void),
-	WS2812FX_getModeCount(void);
+	WS2812FX_getMode(ws2812fx_t *fx),
+	WS2812FX_getTile(ws2812fx_t *fx),
+	WS2812FX_getSpeed(ws2812fx_t *fx),
+	WS2812FX_getBrightness(ws2812fx_t *fx),
+	WS2812FX_getModeCount(void),
+	WS2812FX_getSegmentCount(ws2812fx_t *fx);
 
 uint16_t
-	WS2812FX_getLength(void);
+	WS2812FX_getLength(ws2812fx_t *fx),
+	WS2812FX_getFps(ws2812fx_t *fx);
 
 uint32_t
 	WS2812FX_color_wheel(uint8_t),
-	WS2812FX_getColor(void);
+	WS2812FX_getColor(ws2812fx_t *fx),
+	WS2812FX_getFrameBudget(ws2812fx_t *fx);
+
+//private, the WS2812_ pixel functions act on the instance being rendered
+void
+	WS2812_clear(void),
+	WS2812_waitShow(void),
+	WS2812_fill(uint16_t start, uint16_t len, uint32_t c),
+	WS2812_fade(uint8_t scale),
+	WS2812_diffuse(uint8_t keep, uint8_t seep),
+	WS2812_scroll(int16_t delta),
+	WS2812_writeSpan(uint16_t start, const uint32_t *colors, uint16_t len),
+	WS2812_writeRange(ws2812fx_range_t *range, uint16_t start, const uint32_t *colors, uint16_t len);
 
 //private
 void
 	WS2812FX_strip_off(void),
-	WS2812FX_mode_static(void),
-	WS2812FX_mode_blink(void),
-	WS2812FX_mode_color_wipe(void),
-	WS2812FX_mode_color_wipe_random(void),
-	WS2812FX_mode_random_color(void),
-	WS2812FX_mode_single_dynamic(void),
-	WS2812FX_mode_multi_dynamic(void),
-	WS2812FX_mode_breath(void),
-	WS2812FX_mode_fade(void),
-	WS2812FX_mode_scan(void),
-	WS2812FX_mode_dual_scan(void),
-	WS2812FX_mode_theater_chase(void),
-	WS2812FX_mode_theater_chase_rainbow(void),
-	WS2812FX_mode_rainbow(void),
-	WS2812FX_mode_rainbow_cycle(void),
-	WS2812FX_mode_running_lights(void),
-	WS2812FX_mode_twinkle(void),
-	WS2812FX_mode_twinkle_random(void),
-	WS2812FX_mode_twinkle_fade(void),
-	WS2812FX_mode_twinkle_fade_random(void),
-	WS2812FX_mode_sparkle(void),
-	WS2812FX_mode_flash_sparkle(void),
-	WS2812FX_mode_hyper_sparkle(void),
-	WS2812FX_mode_strobe(void),
-	WS2812FX_mode_strobe_rainbow(void),
-	WS2812FX_mode_multi_strobe(void),
-	WS2812FX_mode_blink_rainbow(void),
-	WS2812FX_mode_chase_white(void),
-	WS2812FX_mode_chase_color(void),
-	WS2812FX_mode_chase_random(void),
-	WS2812FX_mode_chase_rainbow(void),
-	WS2812FX_mode_chase_flash(void),
-	WS2812FX_mode_chase_flash_random(void),
-	WS2812FX_mode_chase_rainbow_white(void),
-	WS2812FX_mode_chase_blackout(void),
-	WS2812FX_mode_chase_blackout_rainbow(void),
-	WS2812FX_mode_color_sweep_random(void),
-	WS2812FX_mode_running_color(void),
-	WS2812FX_mode_running_red_blue(void),
-	WS2812FX_mode_running_random(void),
-	WS2812FX_mode_larson_scanner(void),
-	WS2812FX_mode_comet(void),
-	WS2812FX_mode_fireworks(void),
-	WS2812FX_mode_fireworks_random(void),
-	WS2812FX_mode_merry_christmas(void),
-	WS2812FX_mode_fire_flicker(void),
-	WS2812FX_mode_fire_flicker_soft(void),
-	WS2812FX_mode_fire_flicker_intense(void),
-	WS2812FX_mode_fire_flicker_int(int),
-	WS2812FX_mode_dual_color_wipe_in_out(void),
-	WS2812FX_mode_dual_color_wipe_in_in(void),
-	WS2812FX_mode_dual_color_wipe_out_out(void),
-	WS2812FX_mode_dual_color_wipe_out_in(void),
-	WS2812FX_mode_circus_combustus(void),
-	WS2812FX_mode_halloween(void);
+	WS2812FX_resetMode(void),
+	WS2812FX_rampBrightness(void),
+	WS2812FX_updateFrameBudget(uint32_t render_us),
+	WS2812FX_draw_tile(const uint32_t *tile, uint8_t tile_len, uint8_t phase),
+	WS2812FX_running_tile(const uint32_t *tile, uint8_t tile_len, uint32_t steps),
+	WS2812FX_draw_rainbow(uint8_t offset),
+	WS2812FX_renderRanges(mode_kernel kernel, const ws2812fx_time_t *t, uint32_t arg, const void *data),
+	WS2812FX_kernel_fill(const ws2812fx_time_t *t, ws2812fx_range_t *range),
+	WS2812FX_kernel_tile(const ws2812fx_time_t *t, ws2812fx_range_t *range),
+	WS2812FX_kernel_rainbow(const ws2812fx_time_t *t, ws2812fx_range_t *range),
+	WS2812FX_kernel_running_lights(const ws2812fx_time_t *t, ws2812fx_range_t *range),
+	WS2812FX_kernel_fire_flicker(const ws2812fx_time_t *t, ws2812fx_range_t *range),
+	WS2812FX_kernel_color_waves(const ws2812fx_time_t *t, ws2812fx_range_t *range),
+	WS2812FX_kernel_interference(const ws2812fx_time_t *t, ws2812fx_range_t *range),
+	WS2812FX_mode_static(const ws2812fx_time_t *t),
+	WS2812FX_mode_blink(const ws2812fx_time_t *t),
+	WS2812FX_mode_color_wipe(const ws2812fx_time_t *t),
+	WS2812FX_mode_color_wipe_random(const ws2812fx_time_t *t),
+	WS2812FX_mode_random_color(const ws2812fx_time_t *t),
+	WS2812FX_mode_single_dynamic(const ws2812fx_time_t *t),
+	WS2812FX_mode_multi_dynamic(const ws2812fx_time_t *t),
+	WS2812FX_mode_breath(const ws2812fx_time_t *t),
+	WS2812FX_mode_fade(const ws2812fx_time_t *t),
+	WS2812FX_mode_scan(const ws2812fx_time_t *t),
+	WS2812FX_mode_dual_scan(const ws2812fx_time_t *t),
+	WS2812FX_mode_theater_chase(const ws2812fx_time_t *t),
+	WS2812FX_mode_theater_chase_rainbow(const ws2812fx_time_t *t),
+	WS2812FX_mode_rainbow(const ws2812fx_time_t *t),
+	WS2812FX_mode_rainbow_cycle(const ws2812fx_time_t *t),
+	WS2812FX_mode_running_lights(const ws2812fx_time_t *t),
+	WS2812FX_mode_twinkle(const ws2812fx_time_t *t),
+	WS2812FX_mode_twinkle_random(const ws2812fx_time_t *t),
+	WS2812FX_mode_twinkle_fade(const ws2812fx_time_t *t),
+	WS2812FX_mode_twinkle_fade_random(const ws2812fx_time_t *t),
+	WS2812FX_mode_sparkle(const ws2812fx_time_t *t),
+	WS2812FX_mode_flash_sparkle(const ws2812fx_time_t *t),
+	WS2812FX_mode_hyper_sparkle(const ws2812fx_time_t *t),
+	WS2812FX_mode_strobe(const ws2812fx_time_t *t),
+	WS2812FX_mode_strobe_rainbow(const ws2812fx_time_t *t),
+	WS2812FX_mode_multi_strobe(const ws2812fx_time_t *t),
+	WS2812FX_mode_blink_rainbow(const ws2812fx_time_t *t),
+	WS2812FX_mode_chase_white(const ws2812fx_time_t *t),
+	WS2812FX_mode_chase_color(const ws2812fx_time_t *t),
+	WS2812FX_mode_chase_random(const ws2812fx_time_t *t),
+	WS2812FX_mode_chase_rainbow(const ws2812fx_time_t *t),
+	WS2812FX_mode_chase_flash(const ws2812fx_time_t *t),
+	WS2812FX_mode_chase_flash_random(const ws2812fx_time_t *t),
+	WS2812FX_mode_chase_rainbow_white(const ws2812fx_time_t *t),
+	WS2812FX_mode_chase_blackout(const ws2812fx_time_t *t),
+	WS2812FX_mode_chase_blackout_rainbow(const ws2812fx_time_t *t),
+	WS2812FX_mode_color_sweep_random(const ws2812fx_time_t *t),
+	WS2812FX_mode_running_color(const ws2812fx_time_t *t),
+	WS2812FX_mode_running_red_blue(const ws2812fx_time_t *t),
+	WS2812FX_mode_running_random(const ws2812fx_time_t *t),
+	WS2812FX_mode_larson_scanner(const ws2812fx_time_t *t),
+	WS2812FX_mode_comet(const ws2812fx_time_t *t),
+	WS2812FX_mode_fireworks(const ws2812fx_time_t *t),
+	WS2812FX_mode_fireworks_random(const ws2812fx_time_t *t),
+	WS2812FX_mode_merry_christmas(const ws2812fx_time_t *t),
+	WS2812FX_mode_fire_flicker(const ws2812fx_time_t *t),
+	WS2812FX_mode_fire_flicker_soft(const ws2812fx_time_t *t),
+	WS2812FX_mode_fire_flicker_intense(const ws2812fx_time_t *t),
+	WS2812FX_mode_fire_flicker_int(const ws2812fx_time_t *t, int rev_intensity),
+	WS2812FX_mode_dual_color_wipe_in_out(const ws2812fx_time_t *t),
+	WS2812FX_mode_dual_color_wipe_in_in(const ws2812fx_time_t *t),
+	WS2812FX_mode_dual_color_wipe_out_out(const ws2812fx_time_t *t),
+	WS2812FX_mode_dual_color_wipe_out_in(const ws2812fx_time_t *t),
+	WS2812FX_mode_circus_combustus(const ws2812fx_time_t *t),
+	WS2812FX_mode_halloween(const ws2812fx_time_t *t),
+	WS2812FX_mode_tile(const ws2812fx_time_t *t),
+	WS2812FX_mode_color_waves(const ws2812fx_time_t *t),
+	WS2812FX_mode_interference(const ws2812fx_time_t *t);
 
 #endif
@@ -0,0 +1,143 @@
+/*
+WS2812FX_math.h - Fixed point pixel math for WS2812FX.
+
+Plain C without FreeRTOS or ESP-IDF dependencies, so it can also be
+built and benchmarked on a host.
+
+Colors are packed 0xWWRRGGBB words as used by the WS2812FX frame buffer.
+The kernels work on all four channels of a pixel at once.
+
+LICENSE
+The MIT License (MIT), see WS2812FX.h
+*/
+
+#ifndef WS2812FX_math_h
+#define WS2812FX_math_h
+
+#include <stdint.h>
+
+extern const uint8_t WS2812FX_sin8_table[256];
+extern const int16_t WS2812FX_sin16_table[256];
+extern const uint32_t WS2812FX_wheel_table[256];
+
+// xorshift32 generator state, must not be 0
+typedef struct {
+	uint32_t state;
+} ws2812fx_random_t;
+
+typedef struct {
+	uint8_t h;
+	uint8_t s;
+	uint8_t v;
+} ws2812fx_hsv_t;
+
+/*
+* Scales a by b/256.
+*/
+static inline uint8_t WS2812FX_scale8(uint8_t a, uint8_t b) {
+	return ((uint16_t)a * b) >> 8;
+}
+
+/*
+* Sine of theta with 256 steps per period, returns 128 + 127 * sin().
+*/
+static inline uint8_t WS2812FX_sin8(uint8_t theta) {
+	return WS2812FX_sin8_table[theta];
+}
+
+static inline uint8_t WS2812FX_cos8(uint8_t theta) {
+	return WS2812FX_sin8_table[(uint8_t)(theta + 64)];
+}
+
+/*
+* Sine of theta with 65536 steps per period, returns 32767 * sin().
+* Interpolates linearly between the table entries.
+*/
+static inline int16_t WS2812FX_sin16(uint16_t theta) {
+	int16_t a = WS2812FX_sin16_table[theta >> 8];
+	int16_t b = WS2812FX_sin16_table[(uint8_t)((theta >> 8) + 1)];
+	return a + (((int32_t)(b - a) * (theta & 0xFF)) >> 8);
+}
+
+static inline int16_t WS2812FX_cos16(uint16_t theta) {
+	return WS2812FX_sin16(theta + 16384);
+}
+
+/*
+* Rises from 0 to 254 over the first half of the period and falls back.
+*/
+static inline uint8_t WS2812FX_triwave8(uint8_t theta) {
+	if(theta & 0x80) {
+		theta = 255 - theta;
+	}
+	return theta << 1;
+}
+
+/*
+* Quadratic ease in and out of 0 to 255.
+*/
+static inline uint8_t WS2812FX_ease8InOutQuad(uint8_t i) {
+	uint8_t j = (i & 0x80) ? 255 - i : i;
+	uint8_t jj = WS2812FX_scale8(j, j) << 1;
+	return (i & 0x80) ? 255 - jj : jj;
+}
+
+/*
+* Triangle wave with eased ends, close to a sine but without a table.
+*/
+static inline uint8_t WS2812FX_quadwave8(uint8_t theta) {
+	return WS2812FX_ease8InOutQuad(WS2812FX_triwave8(theta));
+}
+
+static inline uint32_t WS2812FX_random32(ws2812fx_random_t *rng) {
+	uint32_t x = rng->state;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	rng->state = x;
+	return x;
+}
+
+/*
+* Color wheel r -> g -> b -> back to r, see WS2812FX_color_wheel().
+*/
+static inline uint32_t WS2812FX_wheel(uint8_t pos) {
+	return WS2812FX_wheel_table[pos];
+}
+
+/*
+* Scales all channels of c by scale/256.
+*/
+static inline uint32_t WS2812FX_scale32(uint32_t c, uint8_t scale) {
+	uint32_t rb = ((c & 0x00FF00FF) * scale) >> 8;
+	uint32_t wg = ((c >> 8) & 0x00FF00FF) * scale;
+	return (rb & 0x00FF00FF) | (wg & 0xFF00FF00);
+}
+
+/*
+* Adds the channels of a and b, clamping each one at 255.
+*/
+static inline uint32_t WS2812FX_qadd32(uint32_t a, uint32_t b) {
+	uint32_t sum = (a & 0x7F7F7F7F) + (b & 0x7F7F7F7F);
+	sum ^= (a ^ b) & 0x80808080;
+	uint32_t overflow = ((a & b) | ((a | b) & ~sum)) & 0x80808080;
+	return sum | ((overflow >> 7) * 0xFF);
+}
+
+uint32_t
+	WS2812FX_hsv2rgb(uint8_t h, uint8_t s, uint8_t v),
+	WS2812FX_randomRange(ws2812fx_random_t *rng, uint32_t range);
+
+uint8_t
+	WS2812FX_randomDistantHue(ws2812fx_random_t *rng, uint8_t hue, uint8_t distance);
+
+void
+	WS2812FX_randomSeed(ws2812fx_random_t *rng, uint32_t seed),
+	WS2812FX_randomBytes(ws2812fx_random_t *rng, uint8_t *buf, uint16_t len),
+	WS2812FX_hsv2rgbSpan(const ws2812fx_hsv_t *hsv, uint32_t *rgb, uint16_t len),
+	WS2812FX_fadeSpan(uint32_t *px, uint16_t len, uint8_t scale),
+	WS2812FX_addSpan(uint32_t *dst, const uint32_t *src, uint16_t len),
+	WS2812FX_diffuseSpan(uint32_t *px, uint16_t len, uint8_t keep, uint8_t seep),
+	WS2812FX_blurSpan(uint32_t *px, uint16_t len, uint8_t amount);
+
+#endif
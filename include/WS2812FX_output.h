@@ -0,0 +1,112 @@
+/*
+WS2812FX_output.h - Output backends for WS2812FX.
+
+Plain C11 without FreeRTOS or ESP-IDF dependencies, so backends and
+encoders can also be built and benchmarked on a host.
+
+The transmit task turns each frame into wire order bytes, gamma corrected
+and scaled, with the encoder below and hands them to a backend. The backend encodes them into its
+own frame buffers in whatever form its transport needs and sends those.
+WS2812FX keeps WS2812_FRAME_BUFFERS buffers per strip and only encodes the
+bytes that changed since a buffer was last encoded, so encode() must only
+touch the bytes it is given.
+
+LICENSE
+The MIT License (MIT), see WS2812FX.h
+*/
+
+#ifndef WS2812FX_output_h
+#define WS2812FX_output_h
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// order in which the strip expects the color bytes on the wire
+typedef enum {
+	WS2812FX_ORDER_GRB,		// WS2812B, SK6812
+	WS2812FX_ORDER_RGB,		// WS2811
+	WS2812FX_ORDER_BRG,
+	WS2812FX_ORDER_RBG,
+	WS2812FX_ORDER_GBR,
+	WS2812FX_ORDER_BGR
+} ws2812fx_color_order_t;
+
+// called by the backend once a sent frame has been latched, on the target
+// usually from an ISR
+typedef void (*ws2812fx_output_done_t)(void *arg);
+
+typedef struct {
+	int gpio;
+	uint8_t channel;			// RMT channel or SPI host, depending on the backend
+	uint16_t length;			// pixels
+	uint8_t bytes_per_pixel;
+	ws2812fx_output_done_t done;
+	void *done_arg;
+} ws2812fx_output_config_t;
+
+typedef struct {
+	const char *name;
+	// sets up the transport of one strip, returns its state or NULL
+	void *(*open)(const ws2812fx_output_config_t *config);
+	// allocates a frame buffer holding a black frame, NULL if out of memory
+	void *(*alloc)(void *output);
+	// encodes count wire bytes into buffer, starting at byte offset of the frame
+	void (*encode)(void *output, void *buffer, uint32_t offset, const uint8_t *bytes, uint32_t count);
+	// starts sending buffer, the previous frame has been latched already.
+	// Returns false if the frame could not be started, done is not called then.
+	bool (*send)(void *output, void *buffer);
+	// optional: lets the strip start together with the other synchronized
+	// ones. Returns false if the hardware can't or the call failed. A
+	// synchronized strip only starts once all of them have been sent a frame.
+	bool (*synchronize)(void *output);
+	// releases the transport and the state returned by open(), the frame
+	// buffers have been released with free() before
+	void (*close)(void *output);
+} ws2812fx_backend_t;
+
+// turns 0xWWRRGGBB colors into wire order bytes: gamma corrected and
+// brightness scaled 8.8 fixed point values, dithered, in the color order
+// of the strip and with the white byte following the colors on RGBW strips
+typedef struct {
+	uint8_t shifts[3];			// bit positions of the bytes in wire order
+	uint8_t bytes_per_pixel;	// 4 with a white channel
+	bool white_extraction;		// show the white part of a color with the white LED
+	float gamma;				// of gamma_table, 0 before the first table is built
+	uint16_t gamma_table[256];
+	uint16_t table[256];		// gamma_table scaled by level
+	uint8_t level;
+	bool valid;					// table matches gamma_table and level
+	bool fractional;			// some entries can only be shown by dithering
+	uint8_t dither_step;
+} ws2812fx_encoder_t;
+
+// keeps the frames in memory, sends complete right away
+typedef struct {
+	ws2812fx_output_config_t config;
+	const uint8_t *latched;		// last frame sent, config.length * config.bytes_per_pixel bytes
+	uint32_t frames;			// frames sent
+} ws2812fx_memory_output_t;
+
+// SPI bit patterns, every WS2812 bit is sent as 3 SPI bits
+#define WS2812FX_SPI_BITS_PER_BIT 3
+#define WS2812FX_SPI_CLOCK_HZ 2500000	// 400 ns per SPI bit
+
+extern const ws2812fx_backend_t
+	WS2812FX_BACKEND_RMT,
+	WS2812FX_BACKEND_SPI,
+	WS2812FX_BACKEND_MEMORY;
+
+void
+	WS2812FX_spiEncode(uint8_t *out, const uint8_t *bytes, uint32_t count),
+	WS2812FX_encoderInit(ws2812fx_encoder_t *encoder, ws2812fx_color_order_t order, uint8_t bytes_per_pixel),
+	WS2812FX_buildGammaTable(ws2812fx_encoder_t *encoder, float gamma),
+	WS2812FX_buildOutputTable(ws2812fx_encoder_t *encoder, uint8_t level);
+
+uint8_t
+	WS2812FX_nextDither(ws2812fx_encoder_t *encoder);
+
+bool
+	WS2812FX_encode(const ws2812fx_encoder_t *encoder, const ws2812fx_backend_t *backend, void *output, void *buffer,
+		const uint32_t *colors, uint16_t first, uint16_t last, uint8_t threshold);
+
+#endif
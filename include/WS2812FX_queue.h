@@ -0,0 +1,73 @@
+/*
+WS2812FX_queue.h - Lock-free command queues for WS2812FX.
+
+Plain C11 without FreeRTOS or ESP-IDF dependencies, so it can also be
+built and tested on a host.
+
+Control calls post commands here from any task, the service task drains
+them between two frames. Neither side ever blocks: a full queue makes
+push return false and an empty one makes pop return false.
+
+The single-producer queue only needs two indices and no read-modify-write
+operations. The multi-producer queue claims slots with a compare-and-swap
+and marks them published with a per-slot sequence number, so several
+tasks may push at the same time while one task pops.
+
+LICENSE
+The MIT License (MIT), see WS2812FX.h
+*/
+
+#ifndef WS2812FX_queue_h
+#define WS2812FX_queue_h
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+
+#define WS2812FX_QUEUE_LENGTH 16	// must be a power of two
+
+typedef struct {
+	uint8_t type;
+	union {
+		uint32_t value;
+		float fvalue;
+		struct {
+			uint8_t id;
+			bool reverse;
+			uint8_t mode;
+			uint8_t speed;
+			uint16_t start;
+			uint16_t stop;
+			uint32_t color;
+		} segment;	// a whole segment in one command, so it is never shown half set
+	};
+} ws2812fx_command_t;
+
+typedef struct {
+	ws2812fx_command_t commands[WS2812FX_QUEUE_LENGTH];
+	atomic_uint head;	// next slot written, owned by the producer
+	atomic_uint tail;	// next slot read, owned by the consumer
+} ws2812fx_spsc_queue_t;
+
+typedef struct {
+	atomic_uint sequence;	// lap start + 1 once published, next lap start once consumed
+	ws2812fx_command_t command;
+} ws2812fx_mpsc_slot_t;
+
+typedef struct {
+	ws2812fx_mpsc_slot_t slots[WS2812FX_QUEUE_LENGTH];
+	atomic_uint head;	// next slot claimed by a producer
+	unsigned int tail;	// next slot read, only used by the consumer
+} ws2812fx_mpsc_queue_t;
+
+void
+	WS2812FX_spscInit(ws2812fx_spsc_queue_t *queue),
+	WS2812FX_mpscInit(ws2812fx_mpsc_queue_t *queue);
+
+bool
+	WS2812FX_spscPush(ws2812fx_spsc_queue_t *queue, const ws2812fx_command_t *command),
+	WS2812FX_spscPop(ws2812fx_spsc_queue_t *queue, ws2812fx_command_t *command),
+	WS2812FX_mpscPush(ws2812fx_mpsc_queue_t *queue, const ws2812fx_command_t *command),
+	WS2812FX_mpscPop(ws2812fx_mpsc_queue_t *queue, ws2812fx_command_t *command);
+
+#endif
@@ -39,62 +39,229 @@ CHANGELOG
 
 2016-05-28   Initial beta release
 2016-06-03   Code cleanup, minor improvements, new modes
-2016-06-04   2 new fx, fixed setColor (now also resets _mode_color)
+2016-06-04   2 new fx, fixed setColor (now also resets _seg->mode_color)
 2017-02-02   removed "blackout" on mode, speed or color-change
 2018-04-24   ported to esp-open-rtos to use in esp-homekit-demo
 */
 
 #include "WS2812FX.h"
+#include "WS2812FX_math.h"
+#include "WS2812FX_queue.h"
 #include <math.h>
 
 #include <freertos/FreeRTOS.h>
 #include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "freertos/queue.h"
+#include "esp_timer.h"
 
 #include <esp_log.h>
 #include "esp_event.h"	//	for usleep
 #include <string.h>
 
-#include "driver/rmt.h"
+#include "esp_system.h"
 
-#define CALL_MODE(n) _mode[n]();
+#define CALL_MODE(n, t) _mode[n](t);
+
+// pins a task only if there is more than one core
+#define WS2812FX_CORE(n) ((portNUM_PROCESSORS > 1) ? (n) : tskNO_AFFINITY)
 
-#define RMT_TX_CHANNEL 						RMT_CHANNEL_0
-#define WS2812_GPIO 						22
-#define WS2812_LED_NUMBER					32
 #define WS2812_TIMEOUT						100
 
+#define WS2812_FRAME_BUFFERS				2
+
+#define BRIGHTNESS_RAMP_INTERVAL_US			33000
+#define FRAME_INTERVAL_MS					10		// call delay of modes that move smoothly
+#define DITHER_INTERVAL_US					4000	// a dithered frame is sent again this often, 8 phases cycle at 31 Hz
+#define FPS_WINDOW_US						1000000
+
 static const char *TAG = "ws2812_FX";
 
+// control commands posted by the setters, applied by the service task
 typedef enum {
-  PIXEL_RGB = 12,
-  PIXEL_RGBW = 16
-} pixeltype_t;
-
-uint8_t _mode_index = DEFAULT_MODE;
-uint8_t _speed = DEFAULT_SPEED;
-uint8_t _brightness = 0;
-uint8_t _target_brightness = 0;
-bool _running = false;
-bool _inverted = false;
-bool _slow_start = false;
-
-uint16_t _led_count = 0;
-
-uint32_t _color = DEFAULT_COLOR;
-uint32_t _mode_color = DEFAULT_COLOR;
-
-uint32_t _mode_delay = 100;
-uint32_t _counter_mode_call = 0;
-uint32_t _counter_mode_step = 0;
-uint32_t _mode_last_call_time = 0;
+	FX_CMD_START,
+	FX_CMD_STOP,
+	FX_CMD_MODE,
+	FX_CMD_SPEED,
+	FX_CMD_COLOR,
+	FX_CMD_BRIGHTNESS,
+	FX_CMD_FORCE_BRIGHTNESS,
+	FX_CMD_INVERTED,
+	FX_CMD_SLOW_START,
+	FX_CMD_TILE,
+	FX_CMD_SPARK_DENSITY,
+	FX_CMD_SEED,
+	FX_CMD_HARDWARE_RANDOM,
+	FX_CMD_GAMMA,
+	FX_CMD_DITHER,
+	FX_CMD_SEGMENT,
+	FX_CMD_SEGMENTS_RESET,
+	FX_CMD_WHITE_EXTRACTION
+} fx_command_type_t;
+
+// frames handed from the render task to the transmit task
+typedef struct {
+	ws2812fx_t *fx;
+	ws2812_pixel_t *pixels;		// strip order, unscaled
+	uint16_t dirty_first;		// pixels [dirty_first, dirty_last) changed since the previous frame
+	uint16_t dirty_last;
+	uint8_t brightness;
+	bool dither;
+	bool white_extraction;
+	float gamma;
+} ws2812_frame_t;
+
+// part of a strip running its own mode, see WS2812FX_setSegment()
+struct ws2812fx_segment_s {
+	uint16_t start;				// pixels [start, start + length) of the strip
+	uint16_t length;			// 0 while the segment is not set
+	bool reverse;				// the mode runs from the end of the segment
+
+	uint8_t mode_index;
+	uint8_t speed;
+	uint8_t tile_index;
+
+	uint32_t color;
+	uint32_t mode_color;
+
+	uint32_t mode_delay;
+	uint32_t counter_mode_call;
+	uint32_t counter_mode_step;
+	int64_t mode_next_call_time;		// esp_timer time in us the mode is due again
+	int64_t mode_start_time;			// esp_timer time in us the mode was started or reset
+	int64_t mode_last_call_time;
+
+	uint8_t *hue_steps;
+	uint16_t hue_steps_length;
+};
+
+// one strip. The render side is only touched by the service task, which
+// points _fx at the instance it is working on and _seg at the segment it
+// renders, the output stage only by the transmit task.
+struct ws2812fx_s {
+	ws2812fx_config_t config;
+	uint8_t index;					// in _instances
+
+	uint8_t brightness;
+	uint8_t target_brightness;
+	bool running;
+	bool inverted;
+	bool slow_start;
+
+	uint16_t led_count;
+	uint32_t color_mask;			// drops white on strips without a white channel
+
+	ws2812fx_segment_t segments[WS2812FX_MAX_SEGMENTS];
+	uint8_t segment_count;
+
+	int64_t ramp_next_call_time;
+
+	bool show_pending;		// frame buffer or output settings changed, queue a frame
+	int64_t dither_next_call_time;	// the frame is sent again with the next dither phase, INT64_MAX if not
+
+#ifdef WS2812FX_SINGLE_CONTROL_TASK
+	ws2812fx_spsc_queue_t commands;
+#else
+	ws2812fx_mpsc_queue_t commands;
+#endif
+
+	// scene published by WS2812FX_applyState(), guarded by a sequence lock
+	ws2812fx_state_t pending_state;
+	atomic_uint state_sequence;		// odd while pending_state is being written
+	unsigned int applied_sequence;	// last sequence taken over by the service task
+	portMUX_TYPE state_mux;			// serializes the writers
+
+	uint16_t spark_density;
+
+	ws2812fx_random_t random;
+	bool hardware_random;
+
+	ws2812_pixel_t *pixels;		// unscaled colors, brightness is applied by the transmit task
+
+	float gamma;
+	bool dither;
+	bool white_extraction;		// show the white part of a color with the white LED
+
+	ws2812_frame_t frames[WS2812FX_FRAME_QUEUE_DEPTH];
+	QueueHandle_t free_frames;		// slots the render task can fill
+	// render side: strip positions [stale_first, stale_last) of a slot differ from the frame buffer
+	uint16_t stale_first[WS2812FX_FRAME_QUEUE_DEPTH];
+	uint16_t stale_last[WS2812FX_FRAME_QUEUE_DEPTH];
+
+	// render side: pixels changed since the last queued frame and its output settings
+	uint16_t render_dirty_first;
+	uint16_t render_dirty_last;
+	uint8_t queued_brightness;
+	float queued_gamma;
+	bool queued_dither;
+	bool queued_white_extraction;
+
+	// output stage, only touched by the transmit task
+	ws2812fx_encoder_t encoder;
+	volatile bool dither_fractional;	// the last dithered frame has levels between two output values
+
+	// frames encoded by the backend, one is sent while the other one is being encoded
+	const ws2812fx_backend_t *backend;
+	void *output;
+	void *buffers[WS2812_FRAME_BUFFERS];
+	uint8_t back;
+	bool synchronized;			// starts together with the other synchronized strips
+	SemaphoreHandle_t tx_done;
+
+	// pixels [dirty_first, dirty_last) differ from what is encoded in the buffer
+	uint16_t dirty_first[WS2812_FRAME_BUFFERS];
+	uint16_t dirty_last[WS2812_FRAME_BUFFERS];
+	uint16_t origin;				// buffer slot shown by the first LED, moved by WS2812_scroll()
+	uint32_t frame_generation;		// bumped whenever the frame buffer starts to differ from the latched frame
+	uint32_t latched_generation;	// generation currently shown by the LEDs
+
+	// frame rate governor, times are running averages in us
+	int64_t tx_start_time;
+	volatile uint32_t wire_sample_us;	// last frame transmit time, set by WS2812_txDone()
+	volatile uint32_t encode_sample_us;	// last frame encode time, set by the transmit task
+	uint32_t wire_time_us;
+	uint32_t encode_time_us;
+	uint32_t render_time_us;
+	uint32_t frame_budget_us;		// shortest mode call interval the strip keeps up with
+	volatile uint32_t frames_shown;	// counted by the transmit task, never reset
+	uint32_t fps_window_frames;
+	int64_t fps_window_start;
+	uint16_t fps;
+};
+
+ws2812fx_t *_instances[WS2812FX_MAX_INSTANCES];
+atomic_uint _instance_count = 0;	// published after the instance is stored, read with acquire
+portMUX_TYPE _instances_mux = portMUX_INITIALIZER_UNLOCKED;	// serializes WS2812FX_init()
+bool _engine_started = false;		// claimed by the first WS2812FX_init()
+ws2812fx_t *_fx = NULL;			// instance the service task is working on
+ws2812fx_segment_t *_seg = NULL;	// segment of _fx being rendered
+
+TaskHandle_t _service_task = NULL;
+esp_timer_handle_t _service_timer = NULL;	// wakes the service task at the next deadline
+
+typedef struct {
+	uint32_t colors[TILE_MAX_LENGTH];
+	uint8_t length;
+} ws2812fx_tile_t;
+
+ws2812fx_tile_t _tiles[TILE_COUNT];	// patterns registered with WS2812FX_addTile(), shared by all instances
+atomic_uint _tile_count = 0;		// published after the tile is written, read with acquire
+portMUX_TYPE _tile_mux = portMUX_INITIALIZER_UNLOCKED;	// serializes the writers
 	  
 uint8_t get_random_wheel_index(uint8_t);
 
 mode _mode[MODE_COUNT];
 
-// ws2812_pixel_t *pixels;
+QueueHandle_t _queued_frames = NULL;	// frames of all instances waiting for the transmit task, NULL ends a batch
+bool _frames_batched = false;			// frames were queued since the last WS2812_flush()
+TaskHandle_t _transmit_task = NULL;
 
-led_strip_t *strip;
+// pixel-parallel rendering, _range_tasks[r] renders _ranges[r], r = 0 is the render task itself
+ws2812fx_range_t _ranges[WS2812FX_RENDER_WORKERS + 1];
+TaskHandle_t _range_tasks[WS2812FX_RENDER_WORKERS + 1];
+SemaphoreHandle_t _ranges_done = NULL;	// given by a worker when its range is finished
+mode_kernel _range_kernel = NULL;
+const ws2812fx_time_t *_range_time = NULL;
 
 // pixel_settings_t px;
 
@@ -103,6 +270,10 @@ uint32_t color32(uint8_t r, uint8_t g, uint8_t b) {
 	return ((uint32_t)r << 16) | ((uint32_t)g <<  8) | b;
 }
 
+uint32_t color32w(uint8_t r, uint8_t g, uint8_t b, uint8_t w) {
+	return ((uint32_t)w << 24) | color32(r, g, b);
+}
+
 uint32_t constrain(uint32_t amt, uint32_t low, uint32_t high) {
 	return (amt < low) ? low : ((amt > high) ? high : amt);
 }
@@ -113,14 +284,25 @@ float fconstrain(float amt, float low, float high) {
 
 uint32_t randomInRange(uint32_t min, uint32_t max) {
 	if (min < max) {
-		uint32_t randomValue = rand() % (max - min);
-		return randomValue + min;
+		return min + WS2812FX_randomRange(&_fx->random, max - min);
 	} else if (min == max) {
 		return min;
 	}
 	return 0;
 }
 
+/*
+* Fills buf with random bytes, from the hardware RNG if enabled on fx with
+* WS2812FX_setHardwareRandom(), otherwise from the seeded generator rng.
+*/
+void randomFill(const ws2812fx_t *fx, ws2812fx_random_t *rng, uint8_t *buf, uint16_t len) {
+	if (fx->hardware_random) {
+		esp_fill_random(buf, len);
+	} else {
+		WS2812FX_randomBytes(rng, buf, len);
+	}
+}
+
 long map(long x, long in_min, long in_max, long out_min, long out_max) {
 	return (x - in_min) * (out_max - out_min) / (in_max - in_min) + out_min;
 }
@@ -134,190 +316,1511 @@ static uint32_t max(uint32_t a, uint32_t b) {
 }
 
 //LED Adapter
+/*
+* Frame buffer slot holding the pixel shown at position n of strip fx.
+*/
+static inline uint16_t WS2812_slot(const ws2812fx_t *fx, uint16_t n) {
+	uint32_t slot = (uint32_t)n + fx->origin;
+	return (slot >= fx->led_count) ? slot - fx->led_count : slot;
+}
+
+/*
+* Copies strip positions [first, last) from the frame buffer ring into
+* pixels, in strip order.
+*/
+static void WS2812_unroll(ws2812_pixel_t *pixels, uint16_t first, uint16_t last) {
+	uint16_t head = _fx->led_count - _fx->origin;	// positions before the ring wraps
+
+	if (first < head) {
+		uint16_t end = min(last, head);
+		memcpy(&pixels[first], &_fx->pixels[_fx->origin + first], (end - first) * sizeof(ws2812_pixel_t));
+		first = end;
+	}
+	if (first < last) {
+		memcpy(&pixels[first], &_fx->pixels[first - head], (last - first) * sizeof(ws2812_pixel_t));
+	}
+}
+
+static void WS2812_reverse(uint16_t first, uint16_t last) {
+	while (first + 1 < last) {
+		ws2812_pixel_t px = _fx->pixels[first];
+		_fx->pixels[first++] = _fx->pixels[--last];
+		_fx->pixels[last] = px;
+	}
+}
+
+/*
+* Rotates the frame buffer so that slots match strip positions again.
+* Only needed by operations that work on the raw buffer.
+*/
+void WS2812_normalize(void) {
+	if (_fx->origin == 0) {
+		return;
+	}
+	WS2812_reverse(0, _fx->origin);
+	WS2812_reverse(_fx->origin, _fx->led_count);
+	WS2812_reverse(0, _fx->led_count);
+	_fx->origin = 0;
+}
+
+/*
+* Grows the span [*first, *last) to cover [from, to), an empty span
+* becomes [from, to).
+*/
+static inline void WS2812_extendSpan(uint16_t *first, uint16_t *last, uint16_t from, uint16_t to) {
+	if (*first >= *last) {
+		*first = from;
+		*last = to;
+	} else {
+		*first = min(*first, from);
+		*last = max(*last, to);
+	}
+}
+
+/*
+* Render side: pixels [first, last) of the strip have to be encoded again
+* with the next frame, their colors are unchanged.
+*/
+static void WS2812_markEncode(uint16_t first, uint16_t last) {
+	WS2812_extendSpan(&_fx->render_dirty_first, &_fx->render_dirty_last, first, last);
+
+	if (_fx->frame_generation == _fx->latched_generation) {
+		_fx->frame_generation++;
+	}
+}
+
+/*
+* Render side: pixels [first, last) of the strip have changed.
+*/
+void WS2812_markDirty(uint16_t first, uint16_t last) {
+	WS2812_markEncode(first, last);
+	for(uint8_t f=0; f < WS2812FX_FRAME_QUEUE_DEPTH; f++) {
+		WS2812_extendSpan(&_fx->stale_first[f], &_fx->stale_last[f], first, last);
+	}
+}
+
+/*
+* Transmit side: pixels [first, last) have to be encoded again into every
+* output buffer.
+*/
+static void WS2812_markBuffersDirty(ws2812fx_t *fx, uint16_t first, uint16_t last) {
+	for(uint8_t b=0; b < WS2812_FRAME_BUFFERS; b++) {
+		if (fx->dirty_first[b] >= fx->dirty_last[b]) {
+			fx->dirty_first[b] = first;
+			fx->dirty_last[b] = last;
+		} else {
+			fx->dirty_first[b] = min(fx->dirty_first[b], first);
+			fx->dirty_last[b] = max(fx->dirty_last[b], last);
+		}
+	}
+}
+
+/*
+* Called by the backend once a frame has been latched, usually from an ISR.
+*/
+static void IRAM_ATTR WS2812_txDone(void *arg) {
+	ws2812fx_t *fx = arg;
+
+	fx->wire_sample_us = esp_timer_get_time() - fx->tx_start_time;
+
+	if (!xPortInIsrContext()) {
+		xSemaphoreGive(fx->tx_done);
+		return;
+	}
+	BaseType_t woken = pdFALSE;
+	xSemaphoreGiveFromISR(fx->tx_done, &woken);
+	if (woken) {
+		portYIELD_FROM_ISR();
+	}
+}
+
+/*
+* Ends the batch of frames queued by WS2812_show() since the last call.
+* The transmit task starts the frames of one batch on all channels at once.
+*/
+static void WS2812_flush(void) {
+	if (_frames_batched) {
+		_frames_batched = false;
+		ws2812_frame_t *end = NULL;
+		xQueueSend(_queued_frames, &end, portMAX_DELAY);
+	}
+}
+
+/*
+* Hands the frame buffer to the transmit task without waiting for it to be
+* sent. A free frame slot still holds the frame it was last filled with,
+* only the pixels changed since then are copied into it together with the
+* span changed since the previous frame, so the caller can render the next
+* frame right away. Blocks only if WS2812FX_FRAME_QUEUE_DEPTH frames are
+* already waiting. Nothing is queued if the frame is unchanged and not
+* being dithered.
+*/
+static void WS2812_queueFrame(void) {
+	// dithering only hides the fractional levels if the strip can cycle
+	// through the phases fast enough, otherwise it shows as flicker
+	bool dither = _fx->dither && max(_fx->wire_time_us, _fx->encode_time_us) <= DITHER_INTERVAL_US;
+
+	if (_fx->brightness != _fx->queued_brightness || _fx->gamma != _fx->queued_gamma || dither != _fx->queued_dither ||
+		_fx->white_extraction != _fx->queued_white_extraction) {
+		_fx->queued_brightness = _fx->brightness;
+		_fx->queued_gamma = _fx->gamma;
+		_fx->queued_dither = dither;
+		_fx->queued_white_extraction = _fx->white_extraction;
+		WS2812_markEncode(0, _fx->led_count);
+	}
+
+	// a dithered frame differs from the previous one even if the pixels don't
+	if (_fx->frame_generation == _fx->latched_generation && !(_fx->queued_dither && _fx->dither_fractional)) {
+		return;
+	}
+
+	ws2812_frame_t *frame;
+	if (xQueueReceive(_fx->free_frames, &frame, WS2812_TIMEOUT / portTICK_PERIOD_MS) != pdTRUE) {
+		ESP_LOGW(TAG, "frame queue stalled");
+		return;	// the changes stay marked and go out with the next frame
+	}
+
+	uint8_t f = frame - _fx->frames;
+	if (_fx->stale_first[f] < _fx->stale_last[f]) {
+		WS2812_unroll(frame->pixels, _fx->stale_first[f], _fx->stale_last[f]);
+		_fx->stale_first[f] = _fx->stale_last[f] = 0;
+	}
+	frame->dirty_first = _fx->render_dirty_first;
+	frame->dirty_last = _fx->render_dirty_last;
+	frame->brightness = _fx->queued_brightness;
+	frame->gamma = _fx->queued_gamma;
+	frame->dither = _fx->queued_dither;
+	frame->white_extraction = _fx->queued_white_extraction;
+	frame->fx = _fx;
+	xQueueSend(_queued_frames, &frame, portMAX_DELAY);	// there is room for every slot
+	_frames_batched = true;
+
+	_fx->render_dirty_first = _fx->render_dirty_last = 0;
+	_fx->latched_generation = _fx->frame_generation;
+
+	// the next phase follows at a fixed rate, however long the mode waits
+	_fx->dither_next_call_time = _fx->queued_dither ? esp_timer_get_time() + DITHER_INTERVAL_US : INT64_MAX;
+}
+
+/*
+* Marks the frame buffer to be sent. The service task queues one frame
+* once all segments due in this pass are rendered.
+*/
 void WS2812_show(void) {
-	ESP_ERROR_CHECK(strip->refresh(strip, WS2812_TIMEOUT));
+	_fx->show_pending = true;
 }
 
-void WS2812_setPixelColor(uint16_t n, uint8_t r, uint8_t g, uint8_t b) {
-	if (_inverted) { 
-		n = (_led_count - 1) - n; 
+/*
+* Blocks until the last frame passed to WS2812_show() has been latched by
+* the strip.
+*/
+void WS2812_waitShow(void) {
+	if (_fx->show_pending) {
+		_fx->show_pending = false;
+		WS2812_queueFrame();
+	}
+	WS2812_flush();
+
+	// every slot is free again once the last frame has been handed to the backend
+	TickType_t start = xTaskGetTickCount();
+	while (uxQueueMessagesWaiting(_fx->free_frames) < WS2812FX_FRAME_QUEUE_DEPTH) {
+		if (xTaskGetTickCount() - start > WS2812_TIMEOUT / portTICK_PERIOD_MS) {
+			ESP_LOGW(TAG, "frame queue timed out");
+			return;
+		}
+		vTaskDelay(1);
 	}
 
-	uint8_t red = map(r, 0, BRIGHTNESS_MAX, BRIGHTNESS_MIN, _brightness);
-	uint8_t green = map(g, 0, BRIGHTNESS_MAX, BRIGHTNESS_MIN, _brightness);
-	uint8_t blue = map(b, 0, BRIGHTNESS_MAX, BRIGHTNESS_MIN, _brightness);
-	
-	ESP_ERROR_CHECK(strip->set_pixel(strip, n, (uint32_t)red, (uint32_t)green, (uint32_t)blue));
+	if (xSemaphoreTake(_fx->tx_done, WS2812_TIMEOUT / portTICK_PERIOD_MS) == pdTRUE) {
+		xSemaphoreGive(_fx->tx_done);
+	} else {
+		ESP_LOGW(TAG, "frame transmit timed out");
+	}
+}
+
+/*
+* Encodes a queued frame into the idle output buffer. Only pixels changed
+* since that buffer was last encoded are encoded again. Returns false if
+* the frame is already shown and nothing needs to be sent.
+*/
+static bool WS2812_encodeFrame(const ws2812_frame_t *frame) {
+	ws2812fx_t *fx = frame->fx;
+
+	ws2812fx_encoder_t *encoder = &fx->encoder;
+
+	if (frame->gamma != encoder->gamma) {
+		WS2812FX_buildGammaTable(encoder, frame->gamma);
+	}
+	if (!encoder->valid || encoder->level != frame->brightness) {
+		WS2812FX_buildOutputTable(encoder, frame->brightness);
+		WS2812_markBuffersDirty(fx, 0, fx->led_count);
+	}
+	if (frame->dirty_first < frame->dirty_last) {
+		WS2812_markBuffersDirty(fx, frame->dirty_first, frame->dirty_last);
+	}
+
+	uint8_t threshold = 0;
+	bool dither = frame->dither && encoder->fractional;
+	encoder->white_extraction = frame->white_extraction;	// changes mark the whole frame
+
+	if (dither) {
+		threshold = WS2812FX_nextDither(encoder);
+		WS2812_markBuffersDirty(fx, 0, fx->led_count);
+	}
+
+	// every change marks all buffers, so a clean back buffer is the frame on the strip
+	uint8_t b = fx->back;
+	if (fx->dirty_first[b] >= fx->dirty_last[b]) {
+		return false;
+	}
+
+	int64_t start = esp_timer_get_time();
+	bool fractional = WS2812FX_encode(encoder, fx->backend, fx->output, fx->buffers[b],
+		&frame->pixels->color, fx->dirty_first[b], fx->dirty_last[b], threshold);
+	fx->dither_fractional = dither && fractional;	// a dithered frame is always encoded as a whole
+	fx->dirty_first[b] = fx->dirty_last[b] = 0;
+	fx->encode_sample_us = esp_timer_get_time() - start;
+	return true;
+}
+
+/*
+* Sends a batch of frames, at most one per instance and indexed like
+* _instances, and returns their slots. All frames are encoded first, then
+* the batch waits until every strip has latched its previous frame and
+* starts them back to back, so the strips update in the time of the
+* longest one. Synchronized strips only start once all of them have been
+* sent a frame and then start on the same clock, so each of them is part
+* of every batch and sends its current frame again if it has no new one.
+*/
+static void WS2812_sendBatch(ws2812_frame_t **batch) {
+	uint8_t count = atomic_load_explicit(&_instance_count, memory_order_acquire);
+	void *buffers[WS2812FX_MAX_INSTANCES] = { NULL };
+	bool encoded[WS2812FX_MAX_INSTANCES] = { false };
+	bool any = false;
+
+	for(uint8_t i=0; i < count; i++) {
+		if (batch[i] && WS2812_encodeFrame(batch[i])) {
+			ws2812fx_t *fx = _instances[i];
+			buffers[i] = fx->buffers[fx->back];
+			encoded[i] = any = true;
+		}
+	}
+
+	if (any) {
+		for(uint8_t i=0; i < count; i++) {
+			ws2812fx_t *fx = _instances[i];
+			if (!fx->synchronized && fx->backend->synchronize) {
+				// only done here, a synchronized strip that is not sent to stalls the others
+				fx->synchronized = fx->backend->synchronize(fx->output);
+			}
+			if (fx->synchronized && !buffers[i]) {
+				uint8_t front = (fx->back + WS2812_FRAME_BUFFERS - 1) % WS2812_FRAME_BUFFERS;
+				buffers[i] = fx->buffers[front];
+			}
+		}
+
+		// the front buffers are free again once their frames have been latched
+		for(uint8_t i=0; i < count; i++) {
+			if (buffers[i] && xSemaphoreTake(_instances[i]->tx_done, WS2812_TIMEOUT / portTICK_PERIOD_MS) != pdTRUE) {
+				ESP_LOGW(TAG, "frame transmit timed out");
+			}
+		}
+
+		int64_t start = esp_timer_get_time();
+		for(uint8_t i=0; i < count; i++) {
+			if (!buffers[i]) {
+				continue;
+			}
+			ws2812fx_t *fx = _instances[i];
+			fx->tx_start_time = start;
+			if (!fx->backend->send(fx->output, buffers[i])) {
+				// nothing will be latched, so the next batch must not wait for
+				// it. The back buffer stays, the next frame is encoded over it.
+				ESP_LOGW(TAG, "sending frame failed");
+				xSemaphoreGive(fx->tx_done);
+				continue;
+			}
+			if (encoded[i]) {
+				fx->frames_shown++;
+				fx->back = (fx->back + 1) % WS2812_FRAME_BUFFERS;
+			}
+		}
+	}
+
+	for(uint8_t i=0; i < WS2812FX_MAX_INSTANCES; i++) {
+		if (batch[i]) {
+			xQueueSend(batch[i]->fx->free_frames, &batch[i], portMAX_DELAY);
+			batch[i] = NULL;
+		}
+	}
+}
+
+/*
+* Transmit task, collects the frames queued by WS2812_show() into batches
+* and sends them in order. A batch ends with the service pass that queued
+* it or when an instance queues a second frame.
+*/
+static void WS2812_transmit(void *args) {
+	ws2812_frame_t *batch[WS2812FX_MAX_INSTANCES] = { NULL };
+	ws2812_frame_t *frame;
+
+	while (true) {
+		xQueueReceive(_queued_frames, &frame, portMAX_DELAY);
+
+		if (!frame || batch[frame->fx->index]) {
+			WS2812_sendBatch(batch);
+		}
+		if (frame) {
+			batch[frame->fx->index] = frame;
+		}
+	}
+}
+
+/*
+* Strip position of pixel n of segment seg of strip fx.
+*/
+static inline uint16_t WS2812_position(const ws2812fx_t *fx, const ws2812fx_segment_t *seg, uint16_t n) {
+	if (seg->reverse) {
+		n = (seg->length - 1) - n;
+	}
+	n += seg->start;
+	return fx->inverted ? (fx->led_count - 1) - n : n;
+}
+
+/*
+* True if the pixels of segment seg run towards the start of strip fx.
+*/
+static inline bool WS2812_backwards(const ws2812fx_t *fx, const ws2812fx_segment_t *seg) {
+	return seg->reverse != fx->inverted;
+}
+
+/*
+* Strip positions [*first, *last) covered by the segment being rendered.
+*/
+static void WS2812_segmentSpan(uint16_t *first, uint16_t *last) {
+	*first = _fx->inverted ? _fx->led_count - (_seg->start + _seg->length) : _seg->start;
+	*last = *first + _seg->length;
 }
 
 void WS2812_setPixelColor32(uint16_t n, uint32_t c) {
-	uint8_t r = (uint8_t)(c >> 16);
-	uint8_t g = (uint8_t)(c >>  8);
-	uint8_t b = (uint8_t)c;
-	
-	WS2812_setPixelColor(n, r, g, b);
+	if (n >= _seg->length) {
+		return;
+	}
+	n = WS2812_position(_fx, _seg, n);
+
+	c &= _fx->color_mask;
+	uint16_t slot = WS2812_slot(_fx, n);
+	if (_fx->pixels[slot].color != c) {
+		_fx->pixels[slot].color = c;
+		WS2812_markDirty(n, n + 1);
+	}
+}
+
+void WS2812_setPixelColor(uint16_t n, uint8_t r, uint8_t g, uint8_t b) {
+	WS2812_setPixelColor32(n, color32(r, g, b));
+}
+
+void WS2812_setPixelColorW(uint16_t n, uint8_t r, uint8_t g, uint8_t b, uint8_t w) {
+	WS2812_setPixelColor32(n, color32w(r, g, b, w));
+}
+
+/*
+* Sets len pixels starting at start to color c.
+*/
+void WS2812_fill(uint16_t start, uint16_t len, uint32_t c) {
+	if (start >= _seg->length) {
+		return;
+	}
+	len = min(len, _seg->length - start);
+	start = WS2812_position(_fx, _seg, WS2812_backwards(_fx, _seg) ? start + len - 1 : start);
+
+	c &= _fx->color_mask;
+	uint16_t first = start + len;
+	uint16_t last = start;
+	uint16_t slot = WS2812_slot(_fx, start);
+	for(uint16_t i=start; i < start + len; i++) {
+		if (_fx->pixels[slot].color != c) {
+			_fx->pixels[slot].color = c;
+			first = min(first, i);
+			last = i + 1;
+		}
+		if (++slot == _fx->led_count) {
+			slot = 0;
+		}
+	}
+
+	if (first < last) {
+		WS2812_markDirty(first, last);
+	}
+}
+
+/*
+* Copies len colors to the pixels of segment seg of strip fx starting at
+* start and returns the changed strip positions in [*first, *last).
+* Touches nothing but the pixels and never _fx or _seg, so tasks can store
+* disjoint spans at the same time.
+*/
+static void WS2812_storeSpan(ws2812fx_t *fx, const ws2812fx_segment_t *seg, uint16_t start, const uint32_t *colors, uint16_t len, uint16_t *first, uint16_t *last) {
+	*first = UINT16_MAX;
+	*last = 0;
+	if (start >= seg->length) {
+		return;
+	}
+	len = min(len, seg->length - start);
+
+	int16_t step = WS2812_backwards(fx, seg) ? -1 : 1;
+	uint16_t n = WS2812_position(fx, seg, start);
+
+	uint16_t slot = WS2812_slot(fx, n);
+	for(uint16_t i=0; i < len; i++, n += step) {
+		uint32_t c = colors[i] & fx->color_mask;
+		if (fx->pixels[slot].color != c) {
+			fx->pixels[slot].color = c;
+			*first = min(*first, n);
+			*last = max(*last, n + 1);
+		}
+
+		if (step > 0) {
+			slot = (slot + 1 == fx->led_count) ? 0 : slot + 1;
+		} else {
+			slot = (slot == 0) ? fx->led_count - 1 : slot - 1;
+		}
+	}
+}
+
+/*
+* Copies len colors to the pixels starting at start.
+*/
+void WS2812_writeSpan(uint16_t start, const uint32_t *colors, uint16_t len) {
+	uint16_t first, last;
+
+	WS2812_storeSpan(_fx, _seg, start, colors, len, &first, &last);
+	if (first < last) {
+		WS2812_markDirty(first, last);
+	}
+}
+
+/*
+* WS2812_writeSpan() for range kernels, the changes are collected in the
+* range and marked once all ranges are done.
+*/
+void WS2812_writeRange(ws2812fx_range_t *range, uint16_t start, const uint32_t *colors, uint16_t len) {
+	uint16_t first, last;
+
+	WS2812_storeSpan(range->fx, range->seg, start, colors, len, &first, &last);
+	if (first >= last) {
+		return;
+	}
+	if (range->dirty_first >= range->dirty_last) {
+		range->dirty_first = first;
+		range->dirty_last = last;
+	} else {
+		range->dirty_first = min(range->dirty_first, first);
+		range->dirty_last = max(range->dirty_last, last);
+	}
 }
 
 uint32_t WS2812_getPixelColor(uint16_t n) {
-	uint8_t red = 0;
-	uint8_t green = 0;
-	uint8_t blue = 0;
+	if (n >= _seg->length) {
+		return 0;
+	}
+	return _fx->pixels[WS2812_slot(_fx, WS2812_position(_fx, _seg, n))].color;
+}
+
+/*
+* True if the segment being rendered is the only one set on the strip.
+*/
+static bool WS2812_soleSegment(void) {
+	for(uint8_t s=0; s < _fx->segment_count; s++) {
+		if (&_fx->segments[s] != _seg && _fx->segments[s].length > 0) {
+			return false;
+		}
+	}
+	return true;
+}
+
+/*
+* Moves the image of the segment by delta pixels towards its end, pixels
+* pushed off one end come back in at the other one. On a segment covering
+* the whole strip this only moves the buffer origin, the pixels themselves
+* are not copied. That would move the pixels of the other segments as
+* well, so with more than one segment set the span is rotated in place.
+*/
+void WS2812_scroll(int16_t delta) {
+	if (_seg->length == 0) {
+		return;
+	}
+	if (WS2812_backwards(_fx, _seg)) {
+		delta = -delta;
+	}
+
+	if (_seg->length == _fx->led_count && WS2812_soleSegment()) {
+		int32_t origin = ((int32_t)_fx->origin - delta) % _fx->led_count;
+		_fx->origin = (origin < 0) ? origin + _fx->led_count : origin;
+		WS2812_markDirty(0, _fx->led_count);
+		return;
+	}
+
+	int32_t shift = delta % _seg->length;
+	if (shift < 0) {
+		shift += _seg->length;
+	}
+	if (shift == 0) {
+		return;
+	}
+
+	// rotate the span right by shift
+	uint16_t first, last;
+	WS2812_normalize();
+	WS2812_segmentSpan(&first, &last);
+	WS2812_reverse(first, last);
+	WS2812_reverse(first, first + shift);
+	WS2812_reverse(first + shift, last);
+	WS2812_markDirty(first, last);
+}
+
+/*
+* Scales all pixels of the segment by scale/256. Black pixels at both ends
+* are skipped.
+*/
+void WS2812_fade(uint8_t scale) {
+	WS2812_normalize();
+
+	uint16_t first, last;
+	WS2812_segmentSpan(&first, &last);
 
-	ESP_ERROR_CHECK(strip->get_pixel(strip, n, &red, &green, &blue));
+	while (first < last && _fx->pixels[first].color == 0) {
+		first++;
+	}
+	while (last > first && _fx->pixels[last - 1].color == 0) {
+		last--;
+	}
 
-	return color32(red, green, blue);
+	if (first < last) {
+		WS2812FX_fadeSpan(&_fx->pixels[first].color, last - first, scale);
+		WS2812_markDirty(first, last);
+	}
 }
 
+/*
+* Diffuses light along the segment, see WS2812FX_diffuseSpan(). Black
+* pixels at both ends are skipped, except for those light spreads into.
+*/
+void WS2812_diffuse(uint8_t keep, uint8_t seep) {
+	WS2812_normalize();
+
+	uint16_t first, last;
+	WS2812_segmentSpan(&first, &last);
+	uint16_t start = first;
+	uint16_t end = last;
+
+	while (first < last && _fx->pixels[first].color == 0) {
+		first++;
+	}
+	while (last > first && _fx->pixels[last - 1].color == 0) {
+		last--;
+	}
+
+	if (first < last) {
+		first = (first > start) ? first - 1 : first;
+		last = (last < end) ? last + 1 : last;
+		WS2812FX_diffuseSpan(&_fx->pixels[first].color, last - first, keep, seep);
+		WS2812_markDirty(first, last);
+	}
+}
+
+/*
+* Blanks the segment. Call WS2812_show() to send it.
+*/
 void WS2812_clear() {
-    ESP_ERROR_CHECK(strip->clear(strip, WS2812_TIMEOUT));
+	WS2812_normalize();
+
+	uint16_t first, last;
+	WS2812_segmentSpan(&first, &last);
+
+	while (first < last && _fx->pixels[first].color == 0) {
+		first++;
+	}
+	while (last > first && _fx->pixels[last - 1].color == 0) {
+		last--;
+	}
+
+	if (first < last) {
+		memset(&_fx->pixels[first], 0, (last - first) * sizeof(ws2812_pixel_t));
+		WS2812_markDirty(first, last);
+	}
 }
 
-void WS2812_init(uint16_t pixel_count) {
-	_led_count = WS2812_LED_NUMBER;
+/*
+* Sets up the output and the buffers of one strip. The black frame that
+* puts the strip into a known state is sent by the service task.
+*/
+static bool WS2812_init(ws2812fx_t *fx) {
+	fx->led_count = fx->config.length;
+	if (fx->config.pixel_type == PIXEL_RGBW) {
+		WS2812FX_encoderInit(&fx->encoder, fx->config.color_order, 4);
+		fx->color_mask = 0xFFFFFFFF;
+	} else {
+		WS2812FX_encoderInit(&fx->encoder, fx->config.color_order, 3);
+		fx->color_mask = 0x00FFFFFF;
+	}
+
+	fx->pixels = calloc(fx->led_count, sizeof(ws2812_pixel_t));
+	if (!fx->pixels) {
+		ESP_LOGE(TAG, "allocating frame buffer failed");
+		return false;
+	}
+
+	fx->tx_done = xSemaphoreCreateBinary();
+	if (!fx->tx_done) {
+		ESP_LOGE(TAG, "creating transmit semaphore failed");
+		return false;
+	}
+	xSemaphoreGive(fx->tx_done);
+
+	const ws2812fx_output_config_t output_config = {
+		.gpio = fx->config.gpio,
+		.channel = fx->config.channel,
+		.length = fx->led_count,
+		.bytes_per_pixel = fx->encoder.bytes_per_pixel,
+		.done = WS2812_txDone,
+		.done_arg = fx
+	};
+	fx->backend = fx->config.backend ? fx->config.backend : &WS2812FX_BACKEND_RMT;
+	fx->output = fx->backend->open(&output_config);
+	if (!fx->output) {
+		ESP_LOGE(TAG, "opening %s output failed", fx->backend->name);
+		return false;
+	}
+
+	// both start out with a black frame, a batch may send one before anything was rendered
+	for(uint8_t b=0; b < WS2812_FRAME_BUFFERS; b++) {
+		fx->buffers[b] = fx->backend->alloc(fx->output);
+		if (!fx->buffers[b]) {
+			ESP_LOGE(TAG, "allocating output buffer failed");
+			return false;
+		}
+	}
 
-    rmt_config_t config = RMT_DEFAULT_CONFIG_TX(WS2812_GPIO, RMT_TX_CHANNEL);
-    // set counter clock to 40MHz
-    config.clk_div = 2;
+	fx->free_frames = xQueueCreate(WS2812FX_FRAME_QUEUE_DEPTH, sizeof(ws2812_frame_t *));
+	if (!fx->free_frames) {
+		ESP_LOGE(TAG, "creating frame queue failed");
+		return false;
+	}
+	for(uint8_t f=0; f < WS2812FX_FRAME_QUEUE_DEPTH; f++) {
+		ws2812_frame_t *frame = &fx->frames[f];
+		frame->fx = fx;
+		frame->pixels = calloc(fx->led_count, sizeof(ws2812_pixel_t));
+		if (!frame->pixels) {
+			ESP_LOGE(TAG, "allocating frame slot failed");
+			return false;
+		}
+		xQueueSend(fx->free_frames, &frame, 0);
+	}
 
-    ESP_ERROR_CHECK(rmt_config(&config));
-    ESP_ERROR_CHECK(rmt_driver_install(config.channel, 0, 0));
-	
-    // install ws2812 driver
-    led_strip_config_t strip_config = LED_STRIP_DEFAULT_CONFIG(WS2812_LED_NUMBER, (led_strip_dev_t)config.channel);
-    strip = led_strip_new_rmt_ws2812(&strip_config);
-    if (!strip) {
-        ESP_LOGE(TAG, "install WS2812 driver failed");
-    }
+	// the first show sends the whole, still black frame
+	fx->show_pending = true;
+	return true;
+}
 
-	WS2812_clear();
+/*
+* Releases what WS2812_init() set up, in reverse order. Works on a partly
+* set up instance as well, so it is the unwind path of a failed init.
+*/
+static void WS2812_deinit(ws2812fx_t *fx) {
+	for(uint8_t f=0; f < WS2812FX_FRAME_QUEUE_DEPTH; f++) {
+		free(fx->frames[f].pixels);
+	}
+	if (fx->free_frames) {
+		vQueueDelete(fx->free_frames);
+	}
+	for(uint8_t b=0; b < WS2812_FRAME_BUFFERS; b++) {
+		free(fx->buffers[b]);
+	}
+	if (fx->output) {
+		fx->backend->close(fx->output);	// frees the channel for another try
+	}
+	if (fx->tx_done) {
+		vSemaphoreDelete(fx->tx_done);
+	}
+	free(fx->pixels);
 }
 
 //WS2812FX
-void WS2812FX_init(uint16_t pixel_count) {
-	WS2812_init(pixel_count);
-	xTaskCreate(WS2812FX_service, "fxService", 2048, NULL, 2, NULL);
+static void WS2812FX_wakeService(void *arg) {
+	xTaskNotifyGive(_service_task);
+}
+
+/*
+* Lets the service task pick up a changed setting right away instead of
+* sleeping until the current mode delay has passed.
+*/
+static void WS2812FX_notifyService(void) {
+	if (_service_task) {
+		xTaskNotifyGive(_service_task);
+	}
+}
+
+static bool WS2812FX_push(ws2812fx_t *fx, const ws2812fx_command_t *command) {
+#ifdef WS2812FX_SINGLE_CONTROL_TASK
+	return WS2812FX_spscPush(&fx->commands, command);
+#else
+	return WS2812FX_mpscPush(&fx->commands, command);
+#endif
+}
+
+/*
+* Hands a setting to the service task, which applies it between two
+* frames so a mode never sees half of a change. While the queue is full
+* the caller waits up to WS2812_TIMEOUT for the service task to drain it.
+* The service task itself and interrupts cannot wait for the queue to be
+* drained, a command they post to a full queue is dropped.
+*/
+static void WS2812FX_post(ws2812fx_t *fx, const ws2812fx_command_t *command) {
+	bool queued = WS2812FX_push(fx, command);
+
+	if (!queued && !xPortInIsrContext() && xTaskGetCurrentTaskHandle() != _service_task) {
+		TickType_t start = xTaskGetTickCount();
+		while (!queued && xTaskGetTickCount() - start <= WS2812_TIMEOUT / portTICK_PERIOD_MS) {
+			WS2812FX_notifyService();
+			vTaskDelay(1);
+			queued = WS2812FX_push(fx, command);
+		}
+	}
+	if (!queued) {
+		ESP_LOGW(TAG, "command queue full, dropped command %d", command->type);
+	}
+	WS2812FX_notifyService();
+}
+
+static void WS2812FX_postValue(ws2812fx_t *fx, uint8_t type, uint32_t value) {
+	ws2812fx_command_t command = { .type = type, .value = value };
+	WS2812FX_post(fx, &command);
+}
+
+static void WS2812FX_postFloat(ws2812fx_t *fx, uint8_t type, float value) {
+	ws2812fx_command_t command = { .type = type, .fvalue = value };
+	WS2812FX_post(fx, &command);
+}
+
+/*
+* Restarts the modes of all segments of _fx.
+*/
+static void WS2812FX_resetModes(void) {
+	for(uint8_t s=0; s < _fx->segment_count; s++) {
+		_seg = &_fx->segments[s];
+		WS2812FX_resetMode();
+	}
+}
+
+static void WS2812FX_applyCommand(const ws2812fx_command_t *command) {
+	_seg = &_fx->segments[0];	// the single setters act on the first segment
+
+	switch (command->type) {
+		case FX_CMD_START:
+			WS2812FX_resetModes();
+			_fx->running = true;
+			break;
+		case FX_CMD_STOP:
+			_fx->running = false;
+			break;
+		case FX_CMD_MODE:
+			WS2812FX_resetMode();
+			_seg->mode_index = constrain(command->value, 0, MODE_COUNT-1);
+			_seg->mode_color = _seg->color;
+			break;
+		case FX_CMD_SPEED:
+			WS2812FX_resetMode();
+			_seg->speed = constrain(command->value, SPEED_MIN, SPEED_MAX);
+			break;
+		case FX_CMD_COLOR:
+			_seg->color = command->value;
+			WS2812FX_resetMode();
+			_seg->mode_color = _seg->color;
+			break;
+		case FX_CMD_BRIGHTNESS:
+			_fx->target_brightness = constrain(command->value, BRIGHTNESS_MIN, BRIGHTNESS_MAX);
+			break;
+		case FX_CMD_FORCE_BRIGHTNESS:
+			_fx->target_brightness = constrain(command->value, BRIGHTNESS_MIN, BRIGHTNESS_MAX);
+			_fx->brightness = _fx->target_brightness;
+			_fx->show_pending = true;
+			break;
+		case FX_CMD_INVERTED:
+			_fx->inverted = command->value;
+			WS2812FX_resetModes();	// the frame has to be drawn again mirrored
+			break;
+		case FX_CMD_SLOW_START:
+			_fx->slow_start = command->value;
+			break;
+		case FX_CMD_TILE:
+			if(command->value < atomic_load_explicit(&_tile_count, memory_order_acquire)) {
+				_seg->tile_index = command->value;
+				WS2812FX_resetMode();
+			}
+			break;
+		case FX_CMD_SPARK_DENSITY:
+			_fx->spark_density = command->value;
+			break;
+		case FX_CMD_SEED:
+			WS2812FX_randomSeed(&_fx->random, command->value);
+			break;
+		case FX_CMD_HARDWARE_RANDOM:
+			_fx->hardware_random = command->value;
+			break;
+		case FX_CMD_GAMMA:
+			_fx->gamma = fconstrain(command->fvalue, 0.1, 5.0);
+			_fx->show_pending = true;
+			break;
+		case FX_CMD_DITHER:
+			_fx->dither = command->value;
+			_fx->show_pending = true;
+			break;
+		case FX_CMD_SEGMENT:
+			_seg = &_fx->segments[command->segment.id];
+			WS2812_clear();	// drop what is left of the previous segment here
+			_seg->start = command->segment.start;
+			_seg->length = command->segment.stop - command->segment.start;
+			_seg->reverse = command->segment.reverse;
+			_seg->mode_index = constrain(command->segment.mode, 0, MODE_COUNT-1);
+			_seg->speed = constrain(command->segment.speed, SPEED_MIN, SPEED_MAX);
+			_seg->color = command->segment.color;
+			_seg->mode_color = _seg->color;
+			_fx->segment_count = max(_fx->segment_count, command->segment.id + 1);
+			WS2812_clear();
+			WS2812FX_resetMode();
+			break;
+		case FX_CMD_WHITE_EXTRACTION:
+			_fx->white_extraction = command->value;
+			_fx->show_pending = true;
+			break;
+		case FX_CMD_SEGMENTS_RESET:
+			// drop the other segments together with their hue step caches
+			for(uint8_t s=1; s < WS2812FX_MAX_SEGMENTS; s++) {
+				_fx->segments[s].length = 0;
+				free(_fx->segments[s].hue_steps);
+				_fx->segments[s].hue_steps = NULL;
+				_fx->segments[s].hue_steps_length = 0;
+			}
+			_fx->segment_count = 1;
+			_seg->start = 0;
+			_seg->length = _fx->led_count;
+			_seg->reverse = false;
+			WS2812_clear();
+			WS2812FX_resetMode();
+			break;
+	}
+}
+
+/*
+* Copies the scene published by WS2812FX_applyState() if there is a new
+* one. Retries while a writer is busy, writers only hold the lock for the
+* few bytes of the copy.
+*/
+static bool WS2812FX_takeState(ws2812fx_state_t *state) {
+	unsigned int sequence;
+
+	do {
+		sequence = atomic_load_explicit(&_fx->state_sequence, memory_order_acquire);
+		if (sequence == _fx->applied_sequence) {
+			return false;
+		}
+		*state = _fx->pending_state;
+		atomic_thread_fence(memory_order_acquire);
+	} while ((sequence & 1) || atomic_load_explicit(&_fx->state_sequence, memory_order_relaxed) != sequence);
+
+	_fx->applied_sequence = sequence;
+	return true;
+}
+
+/*
+* Applies all queued settings and then the latest scene, if any. Called by
+* the service task between frames.
+*/
+static void WS2812FX_processCommands(void) {
+	ws2812fx_command_t command;
+	ws2812fx_state_t state;
+
+#ifdef WS2812FX_SINGLE_CONTROL_TASK
+	while (WS2812FX_spscPop(&_fx->commands, &command)) {
+#else
+	while (WS2812FX_mpscPop(&_fx->commands, &command)) {
+#endif
+		WS2812FX_applyCommand(&command);
+	}
+
+	if (WS2812FX_takeState(&state)) {
+		_seg = &_fx->segments[0];
+		_seg->mode_index = constrain(state.mode, 0, MODE_COUNT-1);
+		_seg->speed = constrain(state.speed, SPEED_MIN, SPEED_MAX);
+		_seg->color = state.color;
+		_seg->mode_color = _seg->color;
+		_fx->target_brightness = constrain(state.brightness, BRIGHTNESS_MIN, BRIGHTNESS_MAX);
+		WS2812FX_resetMode();
+	}
+}
+
+/*
+* Helper task rendering one range for WS2812FX_renderRanges().
+*/
+static void WS2812FX_renderWorker(void *args) {
+	ws2812fx_range_t *range = args;
+
+	while (true) {
+		ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+		_range_kernel(_range_time, range);
+		xSemaphoreGive(_ranges_done);
+	}
+}
+
+/*
+* Renders the whole strip with a kernel that computes every pixel on its
+* own. Long strips are split into one range per worker plus one for the
+* calling task, which are rendered at the same time. Returns once all
+* ranges are done, with their changes marked for WS2812_show().
+*/
+void WS2812FX_renderRanges(mode_kernel kernel, const ws2812fx_time_t *t, uint32_t arg, const void *data) {
+	uint8_t count = 1;
+	if (_ranges_done && _seg->length >= WS2812FX_PARALLEL_MIN_PIXELS) {
+		count = WS2812FX_RENDER_WORKERS + 1;
+	}
+	uint16_t size = (_seg->length + count - 1) / count;
+
+	_range_kernel = kernel;
+	_range_time = t;
+	for(uint8_t r=0; r < count; r++) {
+		ws2812fx_range_t *range = &_ranges[r];
+		range->first = min(r * size, _seg->length);
+		range->last = min(range->first + size, _seg->length);
+		range->dirty_first = range->dirty_last = 0;
+		range->arg = arg;
+		range->data = data;
+		range->fx = _fx;
+		range->seg = _seg;
+		range->random.state = WS2812FX_random32(&_fx->random) | 1;
+	}
+
+	for(uint8_t r=1; r < count; r++) {
+		xTaskNotifyGive(_range_tasks[r]);
+	}
+	kernel(t, &_ranges[0]);
+	for(uint8_t r=1; r < count; r++) {
+		xSemaphoreTake(_ranges_done, portMAX_DELAY);
+	}
+
+	for(uint8_t r=0; r < count; r++) {
+		if (_ranges[r].dirty_first < _ranges[r].dirty_last) {
+			WS2812_markDirty(_ranges[r].dirty_first, _ranges[r].dirty_last);
+		}
+	}
+}
+
+/*
+* Starts what all instances share: the mode table, the service task that
+* renders every instance, the transmit task that feeds all outputs
+* and the render workers.
+*/
+static void WS2812FX_startEngine(void) {
 	WS2812FX_initModes();
-	WS2812FX_start();
+
+	// every slot of every instance plus the end of the batch it is in
+	_queued_frames = xQueueCreate(2 * WS2812FX_FRAME_QUEUE_DEPTH * WS2812FX_MAX_INSTANCES, sizeof(ws2812_frame_t *));
+	xTaskCreatePinnedToCore(WS2812_transmit, "fxTransmit", 2048, NULL,
+		WS2812FX_TRANSMIT_PRIORITY, &_transmit_task, WS2812FX_CORE(WS2812FX_TRANSMIT_CORE));
+
+	if (WS2812FX_RENDER_WORKERS > 0) {
+		_ranges_done = xSemaphoreCreateCounting(WS2812FX_RENDER_WORKERS, 0);
+	}
+	for(uint8_t r=1; r <= WS2812FX_RENDER_WORKERS; r++) {
+		// spread the workers over the cores other than the render core
+		BaseType_t core = (WS2812FX_RENDER_CORE + r) % portNUM_PROCESSORS;
+		xTaskCreatePinnedToCore(WS2812FX_renderWorker, "fxWorker", 2048, &_ranges[r],
+			WS2812FX_RENDER_PRIORITY, &_range_tasks[r], WS2812FX_CORE(core));
+	}
+
+	const esp_timer_create_args_t timer_args = {
+		.callback = WS2812FX_wakeService,
+		.name = "fxService"
+	};
+	ESP_ERROR_CHECK(esp_timer_create(&timer_args, &_service_timer));
+
+	xTaskCreatePinnedToCore(WS2812FX_service, "fxService", 2048, NULL,
+		WS2812FX_RENDER_PRIORITY, &_service_task, WS2812FX_CORE(WS2812FX_RENDER_CORE));
+}
+
+/*
+* Creates an instance driving one strip on its own GPIO and output channel
+* and starts it. Instances are never freed. Several tasks may create
+* instances at the same time. Returns NULL if the instance can't be
+* created.
+*/
+ws2812fx_t *WS2812FX_init(const ws2812fx_config_t *config) {
+	if(atomic_load_explicit(&_instance_count, memory_order_acquire) >= WS2812FX_MAX_INSTANCES) {
+		ESP_LOGE(TAG, "no more than %d instances", WS2812FX_MAX_INSTANCES);
+		return NULL;
+	}
+	if(config->length == 0) {
+		ESP_LOGE(TAG, "strip without pixels");	// the modes divide by the length
+		return NULL;
+	}
+
+	ws2812fx_t *fx = calloc(1, sizeof(ws2812fx_t));
+	if(!fx) {
+		ESP_LOGE(TAG, "allocating instance failed");
+		return NULL;
+	}
+	fx->config = *config;
+	fx->segment_count = 1;
+	fx->segments[0].length = config->length;
+	fx->segments[0].mode_index = DEFAULT_MODE;
+	fx->segments[0].speed = DEFAULT_SPEED;
+	fx->segments[0].color = DEFAULT_COLOR;
+	fx->segments[0].mode_color = DEFAULT_COLOR;
+	fx->segments[0].mode_delay = 100;
+	fx->spark_density = DEFAULT_SPARK_DENSITY;
+	fx->random.state = DEFAULT_RANDOM_SEED;
+	fx->gamma = 1.0;
+	fx->dither_next_call_time = INT64_MAX;
+	portMUX_INITIALIZE(&fx->state_mux);
+
+	// tasks can't be created inside the critical section, the caller that
+	// claims the start creates them, the engine picks up instances later
+	portENTER_CRITICAL(&_instances_mux);
+	bool start_engine = !_engine_started;
+	_engine_started = true;
+	portEXIT_CRITICAL(&_instances_mux);
+	if(start_engine) {
+		WS2812FX_startEngine();
+	}
+	if(!WS2812_init(fx)) {
+		WS2812_deinit(fx);
+		free(fx);
+		return NULL;
+	}
+
+	// the service and transmit tasks only look at _instance_count entries,
+	// so the entry is stored before the count is published
+	portENTER_CRITICAL(&_instances_mux);
+	unsigned int count = atomic_load_explicit(&_instance_count, memory_order_relaxed);
+	if(count < WS2812FX_MAX_INSTANCES) {
+		fx->index = count;
+		_instances[count] = fx;
+		atomic_store_explicit(&_instance_count, count + 1, memory_order_release);
+	}
+	portEXIT_CRITICAL(&_instances_mux);
+
+	if(count >= WS2812FX_MAX_INSTANCES) {
+		ESP_LOGE(TAG, "no more than %d instances", WS2812FX_MAX_INSTANCES);
+		WS2812_deinit(fx);
+		free(fx);
+		return NULL;
+	}
+
+	WS2812FX_start(fx);
+	return fx;
+}
+
+/*
+* Moves _brightness one step towards _target_brightness.
+*/
+void WS2812FX_rampBrightness(void) {
+	if (_fx->slow_start) {
+		if ((_fx->brightness < _fx->target_brightness)) {
+			uint8_t new_brightness = (BRIGHTNESS_FILTER * _fx->brightness) + ((1.0-BRIGHTNESS_FILTER) * _fx->target_brightness);
+			float soft_start = fconstrain((float)(_fx->brightness * 4) / (float)BRIGHTNESS_MAX, 0.1, 1.0);
+			uint8_t delta = (new_brightness - _fx->brightness) * soft_start;
+			_fx->brightness = _fx->brightness + constrain(delta, 1, delta);
+		} else {
+			_fx->brightness = (BRIGHTNESS_FILTER * _fx->brightness) + ((1.0-BRIGHTNESS_FILTER) * _fx->target_brightness);
+		}
+	} else {
+		_fx->brightness = _fx->target_brightness;
+	}
+}
+
+/*
+* Runs the mode of every segment of _fx whose _mode_delay has passed and
+* steps the brightness every BRIGHTNESS_RAMP_INTERVAL_US while it is
+* ramping. All segments render into the same frame buffer, which is
+* queued once afterwards. Returns when _fx needs to be serviced next,
+* INT64_MAX while it is stopped.
+*/
+static int64_t WS2812FX_serviceInstance(void) {
+	WS2812FX_processCommands();
+
+	if(!_fx->running) {
+		return INT64_MAX;
+	}
+
+	int64_t now = esp_timer_get_time();
+
+	if(_fx->brightness != _fx->target_brightness && now >= _fx->ramp_next_call_time) {
+		WS2812FX_rampBrightness();
+		WS2812_show();	// brightness is applied when the frame is sent
+		_fx->ramp_next_call_time = now + BRIGHTNESS_RAMP_INTERVAL_US;
+	}
+
+	bool rendered = false;
+	for(uint8_t s=0; s < _fx->segment_count; s++) {
+		_seg = &_fx->segments[s];
+		if(_seg->length == 0 || now < _seg->mode_next_call_time) {
+			continue;
+		}
+
+		ws2812fx_time_t time;
+		time.elapsed_us = now - _seg->mode_start_time;
+		time.elapsed_ms = time.elapsed_us / 1000;
+		time.delta_us = _seg->counter_mode_call ? now - _seg->mode_last_call_time : 0;
+		_seg->mode_last_call_time = now;
+
+		_seg->counter_mode_call++;
+		CALL_MODE(_seg->mode_index, &time);
+		rendered = true;
+
+		// keep the cadence unless we fell behind by more than one delay,
+		// then frames are dropped, the modes keep their phase anyway
+		int64_t delay = max(_seg->mode_delay * 1000, _fx->frame_budget_us);
+		_seg->mode_next_call_time += delay;
+		if(_seg->mode_next_call_time < now) {
+			_seg->mode_next_call_time = now + delay;
+		}
+	}
+	if(rendered) {
+		WS2812FX_updateFrameBudget(esp_timer_get_time() - now);
+	}
+
+	// send a dithered frame again with its next phase at DITHER_INTERVAL_US,
+	// the first time once even before the transmit task could tell if it has to
+	if(now >= _fx->dither_next_call_time) {
+		if(_fx->queued_dither && _fx->dither_fractional) {
+			_fx->show_pending = true;
+		}
+		_fx->dither_next_call_time = INT64_MAX;
+	}
+
+	if(_fx->show_pending) {
+		_fx->show_pending = false;
+		WS2812_queueFrame();
+	}
+
+	if(now - _fx->fps_window_start >= FPS_WINDOW_US) {
+		uint32_t frames = _fx->frames_shown;
+		_fx->fps = ((uint64_t)(frames - _fx->fps_window_frames) * 1000000) / (now - _fx->fps_window_start);
+		_fx->fps_window_frames = frames;
+		_fx->fps_window_start = now;
+	}
+
+	int64_t next = INT64_MAX;
+	for(uint8_t s=0; s < _fx->segment_count; s++) {
+		if(_fx->segments[s].length > 0 && _fx->segments[s].mode_next_call_time < next) {
+			next = _fx->segments[s].mode_next_call_time;
+		}
+	}
+	if(_fx->brightness != _fx->target_brightness && _fx->ramp_next_call_time < next) {
+		next = _fx->ramp_next_call_time;
+	}
+	if(_fx->dither_next_call_time < next) {
+		next = _fx->dither_next_call_time;
+	}
+	return next;
 }
 
+/*
+* Services all instances in turn, then sleeps until the earliest deadline
+* of any of them, woken by an esp_timer so delays below one RTOS tick are
+* kept as well. With every instance stopped it sleeps until a setter
+* wakes it up.
+*/
 void WS2812FX_service(void *_args) {
-	uint32_t now = 0;
-	
 	while (true) {
-		if(_running) {
-			//printf("_brightness : _target_brightness %ld : %ld \n", _brightness, _target_brightness);
-			
-            if (_slow_start) {
-			    if ((_brightness < _target_brightness)) {
-                    uint8_t new_brightness = (BRIGHTNESS_FILTER * _brightness) + ((1.0-BRIGHTNESS_FILTER) * _target_brightness);
-                    float soft_start = fconstrain((float)(_brightness * 4) / (float)BRIGHTNESS_MAX, 0.1, 1.0);
-                    uint8_t delta = (new_brightness - _brightness) * soft_start;
-	                _brightness = _brightness + constrain(delta, 1, delta);
-	            } else {
-	                _brightness = (BRIGHTNESS_FILTER * _brightness) + ((1.0-BRIGHTNESS_FILTER) * _target_brightness);
-	            }
-            } else {
-                _brightness = _target_brightness;
-            }
-		
-			now = xTaskGetTickCount() * portTICK_PERIOD_MS;
-			if(now - _mode_last_call_time > _mode_delay) {
-				_counter_mode_call++;
-				_mode_last_call_time = now;
-				CALL_MODE(_mode_index);
-				
-				//gpio_toggle(LED_INBUILT_GPIO); //led indicator
-			}  
+		int64_t next = INT64_MAX;
+		uint8_t count = atomic_load_explicit(&_instance_count, memory_order_acquire);
+
+		for(uint8_t i=0; i < count; i++) {
+			_fx = _instances[i];
+			int64_t due = WS2812FX_serviceInstance();
+			if(due < next) {
+				next = due;
+			}
+		}
+		WS2812_flush();	// the frames of this pass go out together
+
+		if(next == INT64_MAX) {
+			ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+			continue;
+		}
+
+		int64_t wait = next - esp_timer_get_time();
+		if(wait > 0) {
+			esp_timer_start_once(_service_timer, wait);
+			ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+			esp_timer_stop(_service_timer);
 		}
-		vTaskDelay(33 / portTICK_PERIOD_MS);
 	}
 }
 
-void WS2812FX_start() {
-	_counter_mode_call = 0;
-	_counter_mode_step = 0;
-	_running = true;
+/*
+* Keeps running averages of how long a mode call takes, how long the
+* transmit task needs to encode its frame and how long the frame is on
+* the wire, and derives the shortest call interval the strip can sustain.
+* The three stages run in parallel, so the slowest one sets the pace.
+*/
+void WS2812FX_updateFrameBudget(uint32_t render_us) {
+	_fx->render_time_us += ((int32_t)render_us - (int32_t)_fx->render_time_us) / 8;
+	_fx->wire_time_us += ((int32_t)_fx->wire_sample_us - (int32_t)_fx->wire_time_us) / 8;
+	_fx->encode_time_us += ((int32_t)_fx->encode_sample_us - (int32_t)_fx->encode_time_us) / 8;
+
+	uint32_t cost = max(max(_fx->render_time_us, _fx->wire_time_us), _fx->encode_time_us);
+	_fx->frame_budget_us = cost + (cost / 8);	// some headroom against jitter
+}
+
+/*
+* Restarts the current mode: counters and elapsed time go back to zero
+* and the mode is called on the next service run.
+*/
+void WS2812FX_resetMode(void) {
+	_seg->counter_mode_call = 0;
+	_seg->counter_mode_step = 0;
+	_seg->mode_start_time = esp_timer_get_time();
+	_seg->mode_last_call_time = _seg->mode_start_time;
+	_seg->mode_next_call_time = _seg->mode_start_time;
+}
+
+void WS2812FX_start(ws2812fx_t *fx) {
+	WS2812FX_postValue(fx, FX_CMD_START, 0);
 }
 
-void WS2812FX_stop() {
-	_running = false;
+void WS2812FX_stop(ws2812fx_t *fx) {
+	WS2812FX_postValue(fx, FX_CMD_STOP, 0);
 }
 
-void WS2812FX_setMode360(float m) {
+void WS2812FX_setMode360(ws2812fx_t *fx, float m) {
 	//printf("WS2812FX_setMode360: %f", m);
 	uint8_t mode = map((uint16_t)m, 0, 360, 0, MODE_COUNT-1);
 	//printf("WS2812FX_setMode: %d", mode);
-	WS2812FX_setMode(mode);
+	WS2812FX_setMode(fx, mode);
+}
+
+void WS2812FX_setMode(ws2812fx_t *fx, uint8_t m) {
+	WS2812FX_postValue(fx, FX_CMD_MODE, m);
+}
+
+void WS2812FX_setSpeed(ws2812fx_t *fx, uint8_t s) {
+	WS2812FX_postValue(fx, FX_CMD_SPEED, s);
 }
 
-void WS2812FX_setMode(uint8_t m) {
-	_counter_mode_call = 0;
-	_counter_mode_step = 0;
-	_mode_index = constrain(m, 0, MODE_COUNT-1);
-	_mode_color = _color;
+/*
+* Sets mode, speed, color and brightness at once. The service task takes
+* the whole scene over at the next frame, so no frame shows it half
+* applied and the mode is reset only once. If several scenes are applied
+* before that, only the last one is shown. Single setters that reach the
+* service task in the same frame are applied before the scene.
+*/
+void WS2812FX_applyState(ws2812fx_t *fx, const ws2812fx_state_t *state) {
+	portENTER_CRITICAL(&fx->state_mux);
+	unsigned int sequence = atomic_load_explicit(&fx->state_sequence, memory_order_relaxed);
+	atomic_store_explicit(&fx->state_sequence, sequence + 1, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+	fx->pending_state = *state;
+	atomic_store_explicit(&fx->state_sequence, sequence + 2, memory_order_release);
+	portEXIT_CRITICAL(&fx->state_mux);
+
+	WS2812FX_notifyService();
 }
 
-void WS2812FX_setSpeed(uint8_t s) {
-	_counter_mode_call = 0;
-	_counter_mode_step = 0;
-	_speed = constrain(s, SPEED_MIN, SPEED_MAX);
+void WS2812FX_setColor(ws2812fx_t *fx, uint8_t r, uint8_t g, uint8_t b) {
+	WS2812FX_setColor32(fx, ((uint32_t)r << 16) | ((uint32_t)g << 8) | b);
 }
 
-void WS2812FX_setColor(uint8_t r, uint8_t g, uint8_t b) {
-	WS2812FX_setColor32(((uint32_t)r << 16) | ((uint32_t)g << 8) | b);
+void WS2812FX_setColor32(ws2812fx_t *fx, uint32_t c) {
+	WS2812FX_postValue(fx, FX_CMD_COLOR, c);
 }
 
-void WS2812FX_setColor32(uint32_t c) {
-	_color = c;
-	_counter_mode_call = 0;
-	_counter_mode_step = 0;
-	_mode_color = _color;
+void WS2812FX_setBrightness(ws2812fx_t *fx, uint8_t b) {
+	//printf("WS2812FX_setBrightness: %d \n", b);
+	WS2812FX_postValue(fx, FX_CMD_BRIGHTNESS, b);
 }
 
-void WS2812FX_setBrightness(uint8_t b) {
-	_target_brightness = constrain(b, BRIGHTNESS_MIN, BRIGHTNESS_MAX);
-	//printf("WS2812FX_setBrightness: %ld \n", _target_brightness);
+void WS2812FX_forceBrightness(ws2812fx_t *fx, uint8_t b) {
+	WS2812FX_postValue(fx, FX_CMD_FORCE_BRIGHTNESS, b);
 }
 
-void WS2812FX_forceBrightness(uint8_t b) {
-	_target_brightness = constrain(b, BRIGHTNESS_MIN, BRIGHTNESS_MAX);
-	_brightness = _target_brightness;
+bool WS2812FX_isRunning(ws2812fx_t *fx) {
+	return fx->running;
 }
 
-bool WS2812FX_isRunning() {
-	return _running;
+uint8_t WS2812FX_getMode(ws2812fx_t *fx) {
+	return fx->segments[0].mode_index;
 }
 
-uint8_t WS2812FX_getMode(void) {
-	return _mode_index;
+uint8_t WS2812FX_getSpeed(ws2812fx_t *fx) {
+	return fx->segments[0].speed;
 }
 
-uint8_t WS2812FX_getSpeed(void) {
-	return _speed;
+uint8_t WS2812FX_getBrightness(ws2812fx_t *fx) {
+	return fx->target_brightness;
 }
 
-uint8_t WS2812FX_getBrightness(void) {
-	return _target_brightness;
+/*
+* Frames sent to the strip per second, measured over the last second.
+*/
+uint16_t WS2812FX_getFps(ws2812fx_t *fx) {
+	return fx->fps;
 }
 
-uint16_t WS2812FX_getLength(void) {
-	return _led_count;
+/*
+* Shortest time between two frames in us the governor currently allows.
+*/
+uint32_t WS2812FX_getFrameBudget(ws2812fx_t *fx) {
+	return fx->frame_budget_us;
+}
+
+uint16_t WS2812FX_getLength(ws2812fx_t *fx) {
+	return fx->led_count;
 }
 
 uint8_t WS2812FX_getModeCount(void) {
 	return MODE_COUNT;
 }
 
-uint32_t WS2812FX_getColor(void) {
-	return _color;
+uint8_t WS2812FX_getSegmentCount(ws2812fx_t *fx) {
+	return fx->segment_count;
+}
+
+uint32_t WS2812FX_getColor(ws2812fx_t *fx) {
+	return fx->segments[0].color;
 }
 
-void WS2812FX_setInverted(bool inverted) {
-	_inverted = inverted;
+void WS2812FX_setInverted(ws2812fx_t *fx, bool inverted) {
+	WS2812FX_postValue(fx, FX_CMD_INVERTED, inverted);
 }
 
-void WS2812FX_setSlowStart(bool slow_start) {
-	_slow_start = slow_start;
+void WS2812FX_setSlowStart(ws2812fx_t *fx, bool slow_start) {
+	WS2812FX_postValue(fx, FX_CMD_SLOW_START, slow_start);
+}
+
+/*
+* Restarts the random sequence of the effects, the same seed gives the
+* same sequence.
+*/
+void WS2812FX_setSeed(ws2812fx_t *fx, uint32_t seed) {
+	WS2812FX_postValue(fx, FX_CMD_SEED, seed);
+}
+
+/*
+* Takes the noise of fire_flicker from the hardware RNG instead of the
+* seeded generator. It is then no longer reproducible.
+*/
+void WS2812FX_setHardwareRandom(ws2812fx_t *fx, bool hardware_random) {
+	WS2812FX_postValue(fx, FX_CMD_HARDWARE_RANDOM, hardware_random);
+}
+
+/*
+* Registers a pattern of length colors for FX_MODE_TILE. Returns the id
+* to pass to WS2812FX_setTile(), or -1 if the pattern can't be added.
+*/
+int8_t WS2812FX_addTile(const uint32_t *colors, uint8_t length) {
+	if(length == 0 || length > TILE_MAX_LENGTH) {
+		ESP_LOGE(TAG, "can't add tile of length %d", length);
+		return -1;
+	}
+
+	// the service task may be rendering a tile, the new one only becomes
+	// visible to it once it is complete
+	portENTER_CRITICAL(&_tile_mux);
+	unsigned int id = atomic_load_explicit(&_tile_count, memory_order_relaxed);
+	if(id < TILE_COUNT) {
+		ws2812fx_tile_t *tile = &_tiles[id];
+		memcpy(tile->colors, colors, length * sizeof(uint32_t));
+		tile->length = length;
+		atomic_store_explicit(&_tile_count, id + 1, memory_order_release);
+	}
+	portEXIT_CRITICAL(&_tile_mux);
+
+	if(id >= TILE_COUNT) {
+		ESP_LOGE(TAG, "no more than %d tiles", TILE_COUNT);
+		return -1;
+	}
+	return id;
+}
+
+/*
+* Lets pixels [start, stop) of the strip run their own mode. Segments are
+* rendered in the order of their id into one frame, later ones draw over
+* earlier ones where they overlap, and each segment is called at its own
+* pace. The strip is sent once per pass however many segments were due.
+* Segment 0 covers the whole strip until it is set, the other setters
+* act on it. A segment has at least one pixel.
+*/
+void WS2812FX_setSegment(ws2812fx_t *fx, uint8_t id, uint16_t start, uint16_t stop, uint8_t mode, uint32_t color, uint8_t speed, bool reverse) {
+	if(id >= WS2812FX_MAX_SEGMENTS || start >= stop || stop > fx->led_count) {
+		ESP_LOGE(TAG, "can't set segment %d to %d-%d", id, start, stop);
+		return;
+	}
+
+	ws2812fx_command_t command = { .type = FX_CMD_SEGMENT };
+	command.segment.id = id;
+	command.segment.start = start;
+	command.segment.stop = stop;
+	command.segment.mode = mode;
+	command.segment.color = color;
+	command.segment.speed = speed;
+	command.segment.reverse = reverse;
+	WS2812FX_post(fx, &command);
+}
+
+/*
+* Removes all segments but segment 0, which covers the whole strip again.
+*/
+void WS2812FX_resetSegments(ws2812fx_t *fx) {
+	WS2812FX_postValue(fx, FX_CMD_SEGMENTS_RESET, 0);
+}
+
+/*
+* Selects the pattern run by FX_MODE_TILE.
+*/
+void WS2812FX_setTile(ws2812fx_t *fx, uint8_t id) {
+	WS2812FX_postValue(fx, FX_CMD_TILE, id);
+}
+
+uint8_t WS2812FX_getTile(ws2812fx_t *fx) {
+	return fx->segments[0].tile_index;
+}
+
+/*
+* Sets the average number of new fireworks sparks per 1000 LEDs and frame.
+*/
+void WS2812FX_setSparkDensity(ws2812fx_t *fx, uint16_t density) {
+	WS2812FX_postValue(fx, FX_CMD_SPARK_DENSITY, density);
+}
+
+/*
+* Sets the gamma of the output stage, 1.0 sends colors unchanged and
+* about 2.5 matches the perceived brightness of WS2812 LEDs.
+*/
+void WS2812FX_setGamma(ws2812fx_t *fx, float gamma) {
+	WS2812FX_postFloat(fx, FX_CMD_GAMMA, gamma);
+}
+
+/*
+* Enables temporal dithering. Values between two output levels are shown
+* by alternating between them from frame to frame, which smooths dim fades.
+* While the frame has such values it is sent again every DITHER_INTERVAL_US
+* whatever the mode delay. Strips too long to be sent that often are not
+* dithered.
+*/
+void WS2812FX_setDither(ws2812fx_t *fx, bool dither) {
+	WS2812FX_postValue(fx, FX_CMD_DITHER, dither);
+}
+
+/*
+* Shows the white part of every color, the amount all three colors have in
+* common, with the white LED of RGBW strips instead of mixing it from red,
+* green and blue. Whites look cleaner and take less power. No effect on
+* strips without a white channel.
+*/
+void WS2812FX_setWhiteExtraction(ws2812fx_t *fx, bool white_extraction) {
+	WS2812FX_postValue(fx, FX_CMD_WHITE_EXTRACTION, white_extraction);
 }
 
 /* #####################################################
@@ -331,6 +1834,7 @@ void WS2812FX_setSlowStart(bool slow_start) {
 */
 void WS2812FX_strip_off() {
 	WS2812_clear();
+	WS2812_show();
 }
 
 /*
@@ -339,66 +1843,159 @@ void WS2812FX_strip_off() {
 * Inspired by the Adafruit examples.
 */
 uint32_t WS2812FX_color_wheel(uint8_t pos) {
-	pos = 255 - pos;
-	if(pos < 85) {
-		return ((uint32_t)(255 - pos * 3) << 16) | ((uint32_t)(0) << 8) | (pos * 3);
-	} else if(pos < 170) {
-		pos -= 85;
-		return ((uint32_t)(0) << 16) | ((uint32_t)(pos * 3) << 8) | (255 - pos * 3);
-	} else {
-		pos -= 170;
-		return ((uint32_t)(pos * 3) << 16) | ((uint32_t)(255 - pos * 3) << 8) | (0);
+	return WS2812FX_wheel(pos);
+}
+
+/*
+* Hue offsets i * 256 / _led_count that spread one rainbow over the strip.
+* Only rebuilt when the strip length changes.
+*/
+const uint8_t *WS2812FX_hue_steps(void) {
+	if(_seg->hue_steps_length != _seg->length) {
+		free(_seg->hue_steps);
+		_seg->hue_steps = malloc(_seg->length);
+		if(!_seg->hue_steps) {
+			ESP_LOGE(TAG, "allocating hue table failed");
+			_seg->hue_steps_length = 0;
+			return NULL;
+		}
+		for(uint16_t i=0; i < _seg->length; i++) {
+			_seg->hue_steps[i] = ((uint32_t)i * 256) / _seg->length;
+		}
+		_seg->hue_steps_length = _seg->length;
+	}
+	return _seg->hue_steps;
+}
+
+/*
+* Spreads one turn of the color wheel over the strip, starting at offset.
+*/
+void WS2812FX_draw_rainbow(uint8_t offset) {
+	const uint8_t *hue_steps = WS2812FX_hue_steps();	// allocated here, not in the workers
+
+	if(!hue_steps) {
+		return;
+	}
+	WS2812FX_renderRanges(&WS2812FX_kernel_rainbow, NULL, offset, hue_steps);
+}
+
+/*
+* Range kernel of WS2812FX_draw_rainbow(), arg is the hue offset and data
+* the hue steps.
+*/
+void WS2812FX_kernel_rainbow(const ws2812fx_time_t *t, ws2812fx_range_t *range) {
+	const uint8_t *hue_steps = range->data;
+	uint8_t offset = range->arg;
+	uint32_t span[32];
+
+	for(uint16_t i=range->first; i < range->last; i += 32) {
+		uint16_t len = min(32, range->last - i);
+		for(uint16_t k=0; k < len; k++) {
+			span[k] = WS2812FX_wheel(hue_steps[i + k] + offset);
+		}
+		WS2812_writeRange(range, i, span, len);
+	}
+}
+
+/*
+* Range kernel filling all pixels with color arg.
+*/
+void WS2812FX_kernel_fill(const ws2812fx_time_t *t, ws2812fx_range_t *range) {
+	uint32_t span[32];
+
+	for(uint8_t k=0; k < 32; k++) {
+		span[k] = range->arg;
+	}
+	for(uint16_t i=range->first; i < range->last; i += 32) {
+		WS2812_writeRange(range, i, span, min(32, range->last - i));
+	}
+}
+
+
+/*
+* Returns a new, random wheel index with a minimum distance of 42 from pos.
+*/
+uint8_t WS2812FX_get_random_wheel_index(uint8_t pos) {
+	return WS2812FX_randomDistantHue(&_fx->random, pos, 42);
+}
+
+
+/*
+* Number of whole steps of step_ms since the mode was started. Modes
+* derive their phase from this instead of counting calls, so a late or
+* dropped frame does not slow the animation down.
+*/
+static inline uint32_t WS2812FX_steps(const ws2812fx_time_t *t, uint32_t step_ms) {
+	return t->elapsed_us / ((uint64_t)step_ms * 1000);
+}
+
+/*
+* Same as WS2812FX_steps() in 1/256 steps, for modes that can show the
+* position between two steps.
+*/
+static inline uint32_t WS2812FX_steps8(const ws2812fx_time_t *t, uint32_t step_ms) {
+	return (t->elapsed_us << 8) / ((uint64_t)step_ms * 1000);
+}
+
+/*
+* True on the first call in cycle, for modes that pick a new random color
+* once per cycle of their steps. Skipped cycles only pick one.
+*/
+static bool WS2812FX_enterCycle(uint32_t cycle) {
+	if(_seg->counter_mode_step == cycle + 1) {
+		return false;
 	}
+	_seg->counter_mode_step = cycle + 1;
+	return true;
+}
+
+/*
+* Draws pixels [first, last) of the segment in inside and all others in
+* outside. Only pixels that change are touched, so modes can draw their
+* whole state every call.
+*/
+static void WS2812FX_draw_band(uint16_t first, uint16_t last, uint32_t inside, uint32_t outside) {
+	last = max(first, last);
+	WS2812_fill(0, first, outside);
+	WS2812_fill(first, last - first, inside);
+	WS2812_fill(last, _seg->length - last, outside);
 }
 
-
 /*
-* Returns a new, random wheel index with a minimum distance of 42 from pos.
+* Time within a cycle of on_ms lit and off_ms dark, lit first. Returns
+* whether the cycle is lit, sets *cycle to the number of whole cycles and
+* the mode delay to the next change.
 */
-uint8_t WS2812FX_get_random_wheel_index(uint8_t pos) {
-	uint8_t r = 0;
-	uint8_t x = 0;
-	uint8_t y = 0;
-	uint8_t d = 0;
-
-	while(d < 42) {
-		r = randomInRange(0, 256);
-		x = abs(pos - r);
-		y = 255 - x;
-		d = min(x, y);
-	}
+static bool WS2812FX_flash(const ws2812fx_time_t *t, uint32_t on_ms, uint32_t off_ms, uint32_t *cycle) {
+	uint32_t cycle_ms = on_ms + off_ms;
+	uint32_t phase = t->elapsed_ms % cycle_ms;
 
-	return r;
+	*cycle = t->elapsed_ms / cycle_ms;
+	_seg->mode_delay = (phase < on_ms) ? on_ms - phase : cycle_ms - phase;
+	return phase < on_ms;
 }
 
 
 /*
 * No blinking. Just plain old static light.
 */
-void WS2812FX_mode_static(void) {
-	for(uint16_t i=0; i < _led_count; i++) {
-		WS2812_setPixelColor32(i, _color);
-	}
+void WS2812FX_mode_static(const ws2812fx_time_t *t) {
+	WS2812FX_renderRanges(&WS2812FX_kernel_fill, t, _seg->color, NULL);
 	WS2812_show();
 
-	_mode_delay = 50;
+	_seg->mode_delay = 50;
 }
 
 
 /*
 * Normal blinking. 50% on/off time.
 */
-void WS2812FX_mode_blink(void) {
-	if(_counter_mode_call % 2 == 1) {
-		for(uint16_t i=0; i < _led_count; i++) {
-			WS2812_setPixelColor32(i, _color);
-		}
-		WS2812_show();
-	} else {
-		WS2812FX_strip_off();
-	}
+void WS2812FX_mode_blink(const ws2812fx_time_t *t) {
+	uint32_t step_ms = 100 + ((1986 * (uint32_t)(SPEED_MAX - _seg->speed)) / SPEED_MAX);
+	uint32_t cycle;
 
-	_mode_delay = 100 + ((1986 * (uint32_t)(SPEED_MAX - _speed)) / SPEED_MAX);
+	WS2812_fill(0, _seg->length, WS2812FX_flash(t, step_ms, step_ms, &cycle) ? _seg->color : 0);
+	WS2812_show();
 }
 
 
@@ -406,17 +2003,18 @@ void WS2812FX_mode_blink(void) {
 * Lights all LEDs after each other up. Then turns them in
 * that order off. Repeat.
 */
-void WS2812FX_mode_color_wipe(void) {
-	if(_counter_mode_step < _led_count) {
-		WS2812_setPixelColor32(_counter_mode_step, _color);
+void WS2812FX_mode_color_wipe(const ws2812fx_time_t *t) {
+	uint32_t step_ms = 5 + ((50 * (uint32_t)(SPEED_MAX - _seg->speed)) / _seg->length);
+	uint32_t step = WS2812FX_steps(t, step_ms) % (_seg->length * 2);
+
+	if(step < _seg->length) {
+		WS2812FX_draw_band(0, step + 1, _seg->color, 0);
 	} else {
-		WS2812_setPixelColor32(_counter_mode_step - _led_count, 0);
+		WS2812FX_draw_band(0, step - _seg->length + 1, 0, _seg->color);
 	}
 	WS2812_show();
 
-	_counter_mode_step = (_counter_mode_step + 1) % (_led_count * 2);
-
-	_mode_delay = 5 + ((50 * (uint32_t)(SPEED_MAX - _speed)) / _led_count);
+	_seg->mode_delay = step_ms;
 }
 
 
@@ -424,17 +2022,18 @@ void WS2812FX_mode_color_wipe(void) {
 * Turns all LEDs after each other to a random color.
 * Then starts over with another color.
 */
-void WS2812FX_mode_color_wipe_random(void) {
-	if(_counter_mode_step == 0) {
-		_mode_color = WS2812FX_get_random_wheel_index(_mode_color);
+void WS2812FX_mode_color_wipe_random(const ws2812fx_time_t *t) {
+	uint32_t step_ms = 5 + ((50 * (uint32_t)(SPEED_MAX - _seg->speed)) / _seg->length);
+	uint32_t steps = WS2812FX_steps(t, step_ms);
+
+	if(WS2812FX_enterCycle(steps / _seg->length)) {
+		_seg->mode_color = WS2812FX_get_random_wheel_index(_seg->mode_color);
 	}
 
-	WS2812_setPixelColor32(_counter_mode_step, WS2812FX_color_wheel(_mode_color));
+	WS2812_fill(0, (steps % _seg->length) + 1, WS2812FX_color_wheel(_seg->mode_color));
 	WS2812_show();
 
-	_counter_mode_step = (_counter_mode_step + 1) % _led_count;
-
-	_mode_delay = 5 + ((50 * (uint32_t)(SPEED_MAX - _speed)) / _led_count);
+	_seg->mode_delay = step_ms;
 }
 
 
@@ -442,15 +2041,13 @@ void WS2812FX_mode_color_wipe_random(void) {
 * Lights all LEDs in one random color up. Then switches them
 * to the next random color.
 */
-void WS2812FX_mode_random_color(void) {
-	_mode_color = WS2812FX_get_random_wheel_index(_mode_color);
+void WS2812FX_mode_random_color(const ws2812fx_time_t *t) {
+	_seg->mode_color = WS2812FX_get_random_wheel_index(_seg->mode_color);
 
-	for(uint16_t i=0; i < _led_count; i++) {
-		WS2812_setPixelColor32(i, WS2812FX_color_wheel(_mode_color));
-	}
+	WS2812_fill(0, _seg->length, WS2812FX_color_wheel(_seg->mode_color));
 
 	WS2812_show();
-	_mode_delay = 100 + ((5000 * (uint32_t)(SPEED_MAX - _speed)) / SPEED_MAX);
+	_seg->mode_delay = 100 + ((5000 * (uint32_t)(SPEED_MAX - _seg->speed)) / SPEED_MAX);
 }
 
 
@@ -458,16 +2055,16 @@ void WS2812FX_mode_random_color(void) {
 * Lights every LED in a random color. Changes one random LED after the other
 * to another random color.
 */
-void WS2812FX_mode_single_dynamic(void) {
-	if(_counter_mode_call == 0) {
-		for(uint16_t i=0; i < _led_count; i++) {
+void WS2812FX_mode_single_dynamic(const ws2812fx_time_t *t) {
+	if(_seg->counter_mode_call == 0) {
+		for(uint16_t i=0; i < _seg->length; i++) {
 			WS2812_setPixelColor32(i, WS2812FX_color_wheel(randomInRange(0, 256)));
 		}
 	}
 
-	WS2812_setPixelColor32(randomInRange(0, _led_count), WS2812FX_color_wheel(randomInRange(0, 256)));
+	WS2812_setPixelColor32(randomInRange(0, _seg->length), WS2812FX_color_wheel(randomInRange(0, 256)));
 	WS2812_show();
-	_mode_delay = 10 + ((5000 * (uint32_t)(SPEED_MAX - _speed)) / SPEED_MAX);
+	_seg->mode_delay = 10 + ((5000 * (uint32_t)(SPEED_MAX - _seg->speed)) / SPEED_MAX);
 }
 
 
@@ -475,12 +2072,12 @@ void WS2812FX_mode_single_dynamic(void) {
 * Lights every LED in a random color. Changes all LED at the same time
 * to new random colors.
 */
-void WS2812FX_mode_multi_dynamic(void) {
-	for(uint16_t i=0; i < _led_count; i++) {
+void WS2812FX_mode_multi_dynamic(const ws2812fx_time_t *t) {
+	for(uint16_t i=0; i < _seg->length; i++) {
 		WS2812_setPixelColor32(i, WS2812FX_color_wheel(randomInRange(0, 256)));
 	}
 	WS2812_show();
-	_mode_delay = 100 + ((5000 * (uint32_t)(SPEED_MAX - _speed)) / SPEED_MAX);
+	_seg->mode_delay = 100 + ((5000 * (uint32_t)(SPEED_MAX - _seg->speed)) / SPEED_MAX);
 }
 
 
@@ -488,128 +2085,94 @@ void WS2812FX_mode_multi_dynamic(void) {
 * Does the "standby-breathing" of well known i-Devices. Fixed Speed.
 * Use mode "fade" if you like to have something similar with a different speed.
 */
-void WS2812FX_mode_breath(void) {
-	//                                      0    1    2   3   4   5   6    7   8   9  10  11   12   13   14   15   16    // step
-	uint16_t breath_delay_steps[] =     {   7,   9,  13, 15, 16, 17, 18, 930, 19, 18, 15, 13,   9,   7,   4,   5,  10 }; // magic numbers for breathing LED
-	uint8_t breath_brightness_steps[] = { 150, 125, 100, 75, 50, 25, 16,  15, 16, 25, 50, 75, 100, 125, 150, 220, 255 }; // even more magic numbers!
-
-	if(_counter_mode_call == 0) {
-		_mode_color = breath_brightness_steps[0] + 1;
-	}
-
-	uint8_t breath_brightness = _mode_color; // we use _mode_color to store the brightness
-
-	if(_counter_mode_step < 8) {
-		breath_brightness--;
-	} else {
-		breath_brightness++;
-	}
-
-	// update index of current delay when target brightness is reached, start over after the last step
-	if(breath_brightness == breath_brightness_steps[_counter_mode_step]) {
-		_counter_mode_step = (_counter_mode_step + 1) % (sizeof(breath_brightness_steps)/sizeof(uint8_t));
-	}
-
-	for(uint16_t i=0; i < _led_count; i++) {
-		WS2812_setPixelColor32(i, _color);           // set all LEDs to selected color
-	}
-	int b = map(breath_brightness, 0, 255, 0, _brightness);  // keep brightness below brightness set by user
-	WS2812FX_forceBrightness(b);                     // set new brightness to leds
+void WS2812FX_mode_breath(const ws2812fx_time_t *t) {
+	// eased sine between 15/255 and full color, one breath every ~5s
+	uint8_t phase = WS2812FX_steps(t, 20);
+	uint8_t level = 15 + WS2812FX_scale8(WS2812FX_quadwave8(phase), 240);
+	WS2812_fill(0, _seg->length, WS2812FX_scale32(_seg->color, level));
 	WS2812_show();
 
-	_mode_color = breath_brightness;                         // we use _mode_color to store the brightness
-	_mode_delay = breath_delay_steps[_counter_mode_step];
+	_seg->mode_delay = 20;
 }
 
 
 /*
 * Fades the LEDs on and (almost) off again.
 */
-void WS2812FX_mode_fade(void) {
-	for(uint16_t i=0; i < _led_count; i++) {
-		WS2812_setPixelColor32(i, _color);
-	}
+void WS2812FX_mode_fade(const ws2812fx_time_t *t) {
+	uint32_t step_ms = 5 + ((15 * (uint32_t)(SPEED_MAX - _seg->speed)) / SPEED_MAX);
 
-	int b = _counter_mode_step - 127;
-	b = 255 - (abs(b) * 2);
-	b = map(b, 0, 255, min(25, _brightness), _brightness);
-	WS2812FX_forceBrightness(b);
+	// triangle wave between 25/255 and full color
+	uint8_t phase = WS2812FX_steps(t, step_ms);
+	uint8_t level = 25 + WS2812FX_scale8(WS2812FX_triwave8(phase), 230);
+	WS2812_fill(0, _seg->length, WS2812FX_scale32(_seg->color, level));
 	WS2812_show();
 
-	_counter_mode_step = (_counter_mode_step + 1) % 256;
-	_mode_delay = 5 + ((15 * (uint32_t)(SPEED_MAX - _speed)) / SPEED_MAX);
+	_seg->mode_delay = max(step_ms, FRAME_INTERVAL_MS);
 }
 
 
 /*
 * Runs a single pixel back and forth.
 */
-void WS2812FX_mode_scan(void) {
-	if(_counter_mode_step > (_led_count*2) - 2) {
-		_counter_mode_step = 0;
-	}
-	_counter_mode_step++;
+void WS2812FX_mode_scan(const ws2812fx_time_t *t) {
+	uint32_t step_ms = 10 + ((30 * (uint32_t)(SPEED_MAX - _seg->speed)) / _seg->length);
+	uint16_t period = max((_seg->length * 2) - 2, 1);
 
-	int i = _counter_mode_step - (_led_count - 1);
+	int i = (int)(WS2812FX_steps(t, step_ms) % period) - (_seg->length - 1);
 	i = abs(i);
 
 	WS2812_clear();
-	WS2812_setPixelColor32(abs(i), _color);
+	WS2812_setPixelColor32(i, _seg->color);
 	WS2812_show();
 
-	_mode_delay = 10 + ((30 * (uint32_t)(SPEED_MAX - _speed)) / _led_count);
+	_seg->mode_delay = step_ms;
 }
 
 
 /*
 * Runs two pixel back and forth in opposite directions.
 */
-void WS2812FX_mode_dual_scan(void) {
-	if(_counter_mode_step > (_led_count*2) - 2) {
-		_counter_mode_step = 0;
-	}
-	_counter_mode_step++;
+void WS2812FX_mode_dual_scan(const ws2812fx_time_t *t) {
+	uint32_t step_ms = 10 + ((30 * (uint32_t)(SPEED_MAX - _seg->speed)) / _seg->length);
+	uint16_t period = max((_seg->length * 2) - 2, 1);
 
-	int i = _counter_mode_step - (_led_count - 1);
+	int i = (int)(WS2812FX_steps(t, step_ms) % period) - (_seg->length - 1);
 	i = abs(i);
 
 	WS2812_clear();
-	WS2812_setPixelColor32(i, _color);
-	WS2812_setPixelColor32(_led_count - (i+1), _color);
+	WS2812_setPixelColor32(i, _seg->color);
+	WS2812_setPixelColor32(_seg->length - (i+1), _seg->color);
 	WS2812_show();
 
-	_mode_delay = 10 + ((30 * (uint32_t)(SPEED_MAX - _speed)) / _led_count);
+	_seg->mode_delay = step_ms;
 }
 
 
 /*
 * Cycles all LEDs at once through a rainbow.
 */
-void WS2812FX_mode_rainbow(void) {
-	uint32_t color = WS2812FX_color_wheel(_counter_mode_step);
-	for(uint16_t i=0; i < _led_count; i++) {
-		WS2812_setPixelColor32(i, color);
-	}
-	WS2812_show();
+void WS2812FX_mode_rainbow(const ws2812fx_time_t *t) {
+	uint32_t step_ms = 1 + ((100 * (uint32_t)(SPEED_MAX - _seg->speed)) / SPEED_MAX);
 
-	_counter_mode_step = (_counter_mode_step + 1) % 256;
+	uint32_t color = WS2812FX_color_wheel(WS2812FX_steps(t, step_ms));
+	WS2812_fill(0, _seg->length, color);
+	WS2812_show();
 
-	_mode_delay = 1 + ((100 * (uint32_t)(SPEED_MAX - _speed)) / SPEED_MAX);
+	_seg->mode_delay = max(step_ms, FRAME_INTERVAL_MS);
 }
 
 
 /*
 * Cycles a rainbow over the entire string of LEDs.
 */
-void WS2812FX_mode_rainbow_cycle(void) {
-	for(uint16_t i=0; i < _led_count; i++) {
-		WS2812_setPixelColor32(i, WS2812FX_color_wheel(((i * 256 / _led_count) + _counter_mode_step) % 256));
-	}
-	WS2812_show();
+void WS2812FX_mode_rainbow_cycle(const ws2812fx_time_t *t) {
+	uint32_t step_ms = 1 + ((50 * (uint32_t)(SPEED_MAX - _seg->speed)) / SPEED_MAX);
 
-	_counter_mode_step = (_counter_mode_step + 1) % 256;
+	WS2812FX_draw_rainbow(WS2812FX_steps(t, step_ms));
+	WS2812_show();
 
-	_mode_delay = 1 + ((50 * (uint32_t)(SPEED_MAX - _speed)) / SPEED_MAX);
+	_seg->mode_delay = max(step_ms, FRAME_INTERVAL_MS);
 }
 
 
@@ -617,20 +2180,15 @@ void WS2812FX_mode_rainbow_cycle(void) {
 * Theatre-style crawling lights.
 * Inspired by the Adafruit examples.
 */
-void WS2812FX_mode_theater_chase(void) {
-	uint8_t j = _counter_mode_call % 6;
-	if(j % 2 == 0) {
-		for(uint16_t i=0; i < _led_count; i=i+3) {
-			WS2812_setPixelColor32(i+(j/2), _color);
-		}
-		WS2812_show();
-		_mode_delay = 50 + ((500 * (uint32_t)(SPEED_MAX - _speed)) / SPEED_MAX);
-	} else {
-		for(uint16_t i=0; i < _led_count; i=i+3) {
-			WS2812_setPixelColor32(i+(j/2), 0);
-		}
-		_mode_delay = 1;
-	}
+void WS2812FX_mode_theater_chase(const ws2812fx_time_t *t) {
+	uint32_t step_ms = 50 + ((500 * (uint32_t)(SPEED_MAX - _seg->speed)) / SPEED_MAX);
+	uint8_t j = WS2812FX_steps(t, step_ms) % 3;
+
+	const uint32_t tile[] = { _seg->color, 0, 0 };
+	WS2812FX_draw_tile(tile, sizeof(tile)/sizeof(uint32_t), (3 - j) % 3);
+	WS2812_show();
+
+	_seg->mode_delay = step_ms;
 }
 
 
@@ -638,40 +2196,47 @@ void WS2812FX_mode_theater_chase(void) {
 * Theatre-style crawling lights with rainbow effect.
 * Inspired by the Adafruit examples.
 */
-void WS2812FX_mode_theater_chase_rainbow(void) {
-	uint8_t j = _counter_mode_call % 6;
-	if(j % 2 == 0) {
-		for(uint16_t i=0; i < _led_count; i=i+3) {
-			WS2812_setPixelColor32(i+(j/2), WS2812FX_color_wheel((i+_counter_mode_step) % 256));
-		}
-		WS2812_show();
-		_mode_delay = 50 + ((500 * (uint32_t)(SPEED_MAX - _speed)) / SPEED_MAX);
-	} else {
-		for(uint16_t i=0; i < _led_count; i=i+3) {
-			WS2812_setPixelColor32(i+(j/2), 0);
-		}
-		_mode_delay = 1;
+void WS2812FX_mode_theater_chase_rainbow(const ws2812fx_time_t *t) {
+	uint32_t step_ms = 50 + ((500 * (uint32_t)(SPEED_MAX - _seg->speed)) / SPEED_MAX);
+	uint32_t steps = WS2812FX_steps(t, step_ms);
+	uint8_t j = steps % 3;
+
+	for(uint16_t i=0; i < _seg->length; i++) {
+		uint16_t k = i % 3;
+		WS2812_setPixelColor32(i, (k == j) ? WS2812FX_wheel((i - k) + steps) : 0);
 	}
-	_counter_mode_step = (_counter_mode_step + 1) % 256;
+	WS2812_show();
+
+	_seg->mode_delay = step_ms;
 }
 
 
 /*
 * Running lights effect with smooth sine transition.
 */
-void WS2812FX_mode_running_lights(void) {
-	uint8_t r = ((_color >> 16) & 0xFF);
-	uint8_t g = ((_color >> 8) & 0xFF);
-	uint8_t b = (_color & 0xFF);
-
-	for(uint16_t i=0; i < _led_count; i++) {
-		int s = (sin(i+_counter_mode_call) * 127) + 128;
-		WS2812_setPixelColor(i, (((uint32_t)(r * s)) / 255), (((uint32_t)(g * s)) / 255), (((uint32_t)(b * s)) / 255));
-	}
-
+void WS2812FX_mode_running_lights(const ws2812fx_time_t *t) {
+	uint32_t step_ms = 35 + ((350 * (uint32_t)(SPEED_MAX - _seg->speed)) / SPEED_MAX);
+	WS2812FX_renderRanges(&WS2812FX_kernel_running_lights, t, WS2812FX_steps8(t, step_ms), NULL);
 	WS2812_show();
 
-	_mode_delay = 35 + ((350 * (uint32_t)(SPEED_MAX - _speed)) / SPEED_MAX);
+	_seg->mode_delay = FRAME_INTERVAL_MS;
+}
+
+/*
+* Range kernel of running_lights, arg is the position in 1/256 pixels.
+*/
+void WS2812FX_kernel_running_lights(const ws2812fx_time_t *t, ws2812fx_range_t *range) {
+	uint32_t span[32];
+
+	for(uint16_t i=range->first; i < range->last; i += 32) {
+		uint16_t len = min(32, range->last - i);
+		for(uint16_t k=0; k < len; k++) {
+			// one pixel is one radian, 256/2pi = 40.74 table steps
+			uint8_t theta = ((((uint32_t)(i + k) << 8) + range->arg) * 10430) >> 16;
+			span[k] = WS2812FX_scale32(range->seg->color, WS2812FX_sin8(theta));
+		}
+		WS2812_writeRange(range, i, span, len);
+	}
 }
 
 
@@ -679,19 +2244,32 @@ void WS2812FX_mode_running_lights(void) {
 * Blink several LEDs on, reset, repeat.
 * Inspired by www.tweaking4all.com/hardware/arduino/adruino-led-strip-effects/
 */
-void WS2812FX_mode_twinkle(void) {
-	if(_counter_mode_step == 0) {
-		WS2812FX_strip_off();
-		uint32_t min_leds = max(1, _led_count/5); // make sure, at least one LED is on
-		uint32_t max_leds = max(1, _led_count/2); // make sure, at least one LED is on
-		_counter_mode_step = randomInRange(min_leds, max_leds);
+void WS2812FX_mode_twinkle(const ws2812fx_time_t *t) {
+	uint32_t step_ms = 50 + ((1986 * (uint32_t)(SPEED_MAX - _seg->speed)) / SPEED_MAX);
+	uint32_t step = WS2812FX_steps(t, step_ms);
+	uint32_t last = step - 1;	// the first call lights one LED
+	if(t->delta_us > 0) {
+		last = (t->elapsed_us - t->delta_us) / ((uint64_t)step_ms * 1000);
+	}
+	if(step - last > _seg->length) {
+		last = step - _seg->length;	// more steps would only relight the same round
+	}
+
+	uint32_t min_leds = max(1, _seg->length/5); // make sure, at least one LED is on
+	uint32_t max_leds = max(1, _seg->length/2); // make sure, at least one LED is on
+
+	// one LED per step since the last call, counter_mode_step is the step
+	// the current round ends at, a slower speed can leave it far ahead
+	for(uint32_t s = last + 1; s != step + 1; s++) {
+		if(s >= _seg->counter_mode_step || _seg->counter_mode_step - s > max_leds) {
+			WS2812_clear();
+			_seg->counter_mode_step = s + randomInRange(min_leds, max_leds);
+		}
+		WS2812_setPixelColor32(randomInRange(0, _seg->length), _seg->mode_color);
 	}
-
-	WS2812_setPixelColor32(randomInRange(0, _led_count), _mode_color);
 	WS2812_show();
 
-	_counter_mode_step--;
-	_mode_delay = 50 + ((1986 * (uint32_t)(SPEED_MAX - _speed)) / SPEED_MAX);
+	_seg->mode_delay = step_ms - (t->elapsed_ms % step_ms);
 }
 
 
@@ -699,48 +2277,34 @@ void WS2812FX_mode_twinkle(void) {
 * Blink several LEDs in random colors on, reset, repeat.
 * Inspired by www.tweaking4all.com/hardware/arduino/adruino-led-strip-effects/
 */
-void WS2812FX_mode_twinkle_random(void) {
-	_mode_color = WS2812FX_color_wheel(randomInRange(0, 256));
-	WS2812FX_mode_twinkle();
+void WS2812FX_mode_twinkle_random(const ws2812fx_time_t *t) {
+	_seg->mode_color = WS2812FX_color_wheel(randomInRange(0, 256));
+	WS2812FX_mode_twinkle(t);
 }
 
 
 /*
 * Blink several LEDs on, fading out.
 */
-void WS2812FX_mode_twinkle_fade(void) {
-
-	for(uint16_t i=0; i < _led_count; i++) {
-		uint32_t px_rgb = WS2812_getPixelColor(i);
-
-		uint8_t px_r = (px_rgb & 0x00FF0000) >> 16;
-		uint8_t px_g = (px_rgb & 0x0000FF00) >>  8;
-		uint8_t px_b = (px_rgb & 0x000000FF) >>  0;
-
-		// fade out (divide by 2)
-		px_r = px_r >> 1;
-		px_g = px_g >> 1;
-		px_b = px_b >> 1;
-
-		WS2812_setPixelColor(i, px_r, px_g, px_b);
-	}
+void WS2812FX_mode_twinkle_fade(const ws2812fx_time_t *t) {
+	WS2812_fade(128); // fade out (divide by 2)
 
 	if(randomInRange(0, 3) == 0) {
-		WS2812_setPixelColor32(randomInRange(0, _led_count), _mode_color);
+		WS2812_setPixelColor32(randomInRange(0, _seg->length), _seg->mode_color);
 	}
 
 	WS2812_show();
 
-	_mode_delay = 100 + ((100 * (uint32_t)(SPEED_MAX - _speed)) / SPEED_MAX);
+	_seg->mode_delay = 100 + ((100 * (uint32_t)(SPEED_MAX - _seg->speed)) / SPEED_MAX);
 }
 
 
 /*
 * Blink several LEDs in random colors on, fading out.
 */
-void WS2812FX_mode_twinkle_fade_random(void) {
-	_mode_color = WS2812FX_color_wheel(randomInRange(0, 256));
-	WS2812FX_mode_twinkle_fade();
+void WS2812FX_mode_twinkle_fade_random(const ws2812fx_time_t *t) {
+	_seg->mode_color = WS2812FX_color_wheel(randomInRange(0, 256));
+	WS2812FX_mode_twinkle_fade(t);
 }
 
 
@@ -748,11 +2312,11 @@ void WS2812FX_mode_twinkle_fade_random(void) {
 * Blinks one LED at a time.
 * Inspired by www.tweaking4all.com/hardware/arduino/adruino-led-strip-effects/
 */
-void WS2812FX_mode_sparkle(void) {
+void WS2812FX_mode_sparkle(const ws2812fx_time_t *t) {
 	WS2812_clear();
-	WS2812_setPixelColor32(randomInRange(0, _led_count),_color);
+	WS2812_setPixelColor32(randomInRange(0, _seg->length),_seg->color);
 	WS2812_show();
-	_mode_delay = 10 + ((200 * (uint32_t)(SPEED_MAX - _speed)) / SPEED_MAX);
+	_seg->mode_delay = 10 + ((200 * (uint32_t)(SPEED_MAX - _seg->speed)) / SPEED_MAX);
 }
 
 
@@ -760,16 +2324,14 @@ void WS2812FX_mode_sparkle(void) {
 * Lights all LEDs in the _color. Flashes single white pixels randomly.
 * Inspired by www.tweaking4all.com/hardware/arduino/adruino-led-strip-effects/
 */
-void WS2812FX_mode_flash_sparkle(void) {
-	for(uint16_t i=0; i < _led_count; i++) {
-		WS2812_setPixelColor32(i, _color);
-	}
+void WS2812FX_mode_flash_sparkle(const ws2812fx_time_t *t) {
+	WS2812_fill(0, _seg->length, _seg->color);
 
 	if(randomInRange(0, 10) == 7) {
-		WS2812_setPixelColor(randomInRange(0, _led_count), 255, 255, 255);
-		_mode_delay = 20;
+		WS2812_setPixelColor(randomInRange(0, _seg->length), 255, 255, 255);
+		_seg->mode_delay = 20;
 	} else {
-		_mode_delay = 20 + ((200 * (uint32_t)(SPEED_MAX - _speed)) / SPEED_MAX);
+		_seg->mode_delay = 20 + ((200 * (uint32_t)(SPEED_MAX - _seg->speed)) / SPEED_MAX);
 	}
 
 	WS2812_show();
@@ -780,18 +2342,16 @@ void WS2812FX_mode_flash_sparkle(void) {
 * Like flash sparkle. With more flash.
 * Inspired by www.tweaking4all.com/hardware/arduino/adruino-led-strip-effects/
 */
-void WS2812FX_mode_hyper_sparkle(void) {
-	for(uint16_t i=0; i < _led_count; i++) {
-		WS2812_setPixelColor32(i, _color);
-	}
+void WS2812FX_mode_hyper_sparkle(const ws2812fx_time_t *t) {
+	WS2812_fill(0, _seg->length, _seg->color);
 
 	if(randomInRange(0, 10) < 4) {
-		for(uint16_t i=0; i < max(1, _led_count/3); i++) {
-			WS2812_setPixelColor(randomInRange(0, _led_count), 255, 255, 255);
+		for(uint16_t i=0; i < max(1, _seg->length/3); i++) {
+			WS2812_setPixelColor(randomInRange(0, _seg->length), 255, 255, 255);
 		}
-		_mode_delay = 20;
+		_seg->mode_delay = 20;
 	} else {
-		_mode_delay = 15 + ((120 * (uint32_t)(SPEED_MAX - _speed)) / SPEED_MAX);
+		_seg->mode_delay = 15 + ((120 * (uint32_t)(SPEED_MAX - _seg->speed)) / SPEED_MAX);
 	}
 
 	WS2812_show();
@@ -801,18 +2361,11 @@ void WS2812FX_mode_hyper_sparkle(void) {
 /*
 * Classic Strobe effect.
 */
-void WS2812FX_mode_strobe(void) {
-	if(_counter_mode_call % 2 == 0) {
-		for(uint16_t i=0; i < _led_count; i++) {
-			WS2812_setPixelColor32(i, _color);
-		}
-		_mode_delay = 20;
-	} else {
-		for(uint16_t i=0; i < _led_count; i++) {
-			WS2812_setPixelColor32(i, 0);
-		}
-		_mode_delay = 50 + ((1986 * (uint32_t)(SPEED_MAX - _speed)) / SPEED_MAX);
-	}
+void WS2812FX_mode_strobe(const ws2812fx_time_t *t) {
+	uint32_t off_ms = 50 + ((1986 * (uint32_t)(SPEED_MAX - _seg->speed)) / SPEED_MAX);
+	uint32_t cycle;
+
+	WS2812_fill(0, _seg->length, WS2812FX_flash(t, 20, off_ms, &cycle) ? _seg->color : 0);
 	WS2812_show();
 }
 
@@ -820,45 +2373,34 @@ void WS2812FX_mode_strobe(void) {
 /*
 * Strobe effect with different strobe count and pause, controled by _speed.
 */
-void WS2812FX_mode_multi_strobe(void) {
-	for(uint16_t i=0; i < _led_count; i++) {
-		WS2812_setPixelColor32(i, 0);
-	}
-
-	if(_counter_mode_step < (2 * ((_speed / 10) + 1))) {
-		if(_counter_mode_step % 2 == 0) {
-			for(uint16_t i=0; i < _led_count; i++) {
-				WS2812_setPixelColor32(i, _color);
-			}
-			_mode_delay = 20;
-		} else {
-			_mode_delay = 50;
-		}
-
+void WS2812FX_mode_multi_strobe(const ws2812fx_time_t *t) {
+	uint32_t flash_ms = (((uint32_t)_seg->speed / 10) + 1) * 70;	// 20 ms on, 50 ms off per flash
+	uint32_t pause_ms = 100 + ((9 - (_seg->speed % 10)) * 125);
+	uint32_t phase = t->elapsed_ms % (flash_ms + pause_ms);
+	bool on = false;
+
+	if(phase < flash_ms) {
+		uint32_t flash = phase % 70;
+		on = flash < 20;
+		_seg->mode_delay = on ? 20 - flash : 70 - flash;
 	} else {
-		_mode_delay = 100 + ((9 - (_speed % 10)) * 125);
+		_seg->mode_delay = flash_ms + pause_ms - phase;
 	}
 
+	WS2812_fill(0, _seg->length, on ? _seg->color : 0);
 	WS2812_show();
-	_counter_mode_step = (_counter_mode_step + 1) % ((2 * ((_speed / 10) + 1)) + 1);
 }
 
 
 /*
 * Classic Strobe effect. Cycling through the rainbow.
 */
-void WS2812FX_mode_strobe_rainbow(void) {
-	if(_counter_mode_call % 2 == 0) {
-		for(uint16_t i=0; i < _led_count; i++) {
-			WS2812_setPixelColor32(i, WS2812FX_color_wheel(_counter_mode_call % 256));
-		}
-		_mode_delay = 20;
-	} else {
-		for(uint16_t i=0; i < _led_count; i++) {
-			WS2812_setPixelColor32(i, 0);
-		}
-		_mode_delay = 50 + ((1986 * (uint32_t)(SPEED_MAX - _speed)) / SPEED_MAX);
-	}
+void WS2812FX_mode_strobe_rainbow(const ws2812fx_time_t *t) {
+	uint32_t off_ms = 50 + ((1986 * (uint32_t)(SPEED_MAX - _seg->speed)) / SPEED_MAX);
+	uint32_t cycle;
+
+	bool on = WS2812FX_flash(t, 20, off_ms, &cycle);
+	WS2812_fill(0, _seg->length, on ? WS2812FX_color_wheel((cycle * 2) % 256) : 0);
 	WS2812_show();
 }
 
@@ -866,126 +2408,135 @@ void WS2812FX_mode_strobe_rainbow(void) {
 /*
 * Classic Blink effect. Cycling through the rainbow.
 */
-void WS2812FX_mode_blink_rainbow(void) {
-	if(_counter_mode_call % 2 == 1) {
-		for(uint16_t i=0; i < _led_count; i++) {
-			WS2812_setPixelColor32(i, WS2812FX_color_wheel(_counter_mode_call % 256));
-		}
-		WS2812_show();
-	} else {
-		WS2812FX_strip_off();
-	}
+void WS2812FX_mode_blink_rainbow(const ws2812fx_time_t *t) {
+	uint32_t step_ms = 100 + ((1986 * (uint32_t)(SPEED_MAX - _seg->speed)) / SPEED_MAX);
+	uint32_t cycle;
 
-	_mode_delay = 100 + ((1986 * (uint32_t)(SPEED_MAX - _speed)) / SPEED_MAX);
+	bool on = WS2812FX_flash(t, step_ms, step_ms, &cycle);
+	WS2812_fill(0, _seg->length, on ? WS2812FX_color_wheel(((cycle * 2) + 1) % 256) : 0);
+	WS2812_show();
 }
 
 
 /*
 * _color running on white.
 */
-void WS2812FX_mode_chase_white(void) {
-	for(uint16_t i=0; i < _led_count; i++) {
-		WS2812_setPixelColor(i, 255, 255, 255);
-	}
+void WS2812FX_mode_chase_white(const ws2812fx_time_t *t) {
+	uint32_t step_ms = 10 + ((30 * (uint32_t)(SPEED_MAX - _seg->speed)) / _seg->length);
+	uint32_t steps = WS2812FX_steps(t, step_ms);
 
-	uint16_t n = _counter_mode_step;
-	uint16_t m = (_counter_mode_step + 1) % _led_count;
-	WS2812_setPixelColor32(n, _color);
-	WS2812_setPixelColor32(m, _color);
+	WS2812_fill(0, _seg->length, 0xFFFFFF);
+
+	uint16_t n = steps % _seg->length;
+	uint16_t m = (n + 1) % _seg->length;
+	WS2812_setPixelColor32(n, _seg->color);
+	WS2812_setPixelColor32(m, _seg->color);
 	WS2812_show();
 
-	_counter_mode_step = (_counter_mode_step + 1) % _led_count;
-	_mode_delay = 10 + ((30 * (uint32_t)(SPEED_MAX - _speed)) / _led_count);
+	_seg->mode_delay = step_ms;
 }
 
 
 /*
 * White running on _color.
 */
-void WS2812FX_mode_chase_color(void) {
-	for(uint16_t i=0; i < _led_count; i++) {
-		WS2812_setPixelColor32(i, _color);
-	}
+void WS2812FX_mode_chase_color(const ws2812fx_time_t *t) {
+	uint32_t step_ms = 10 + ((30 * (uint32_t)(SPEED_MAX - _seg->speed)) / _seg->length);
+	uint32_t steps = WS2812FX_steps(t, step_ms);
 
-	uint16_t n = _counter_mode_step;
-	uint16_t m = (_counter_mode_step + 1) % _led_count;
+	WS2812_fill(0, _seg->length, _seg->color);
+
+	uint16_t n = steps % _seg->length;
+	uint16_t m = (n + 1) % _seg->length;
 	WS2812_setPixelColor(n, 255, 255, 255);
 	WS2812_setPixelColor(m, 255, 255, 255);
 	WS2812_show();
 
-	_counter_mode_step = (_counter_mode_step + 1) % _led_count;
-	_mode_delay = 10 + ((30 * (uint32_t)(SPEED_MAX - _speed)) / _led_count);
+	_seg->mode_delay = step_ms;
 }
 
 
 /*
 * White running followed by random color.
 */
-void WS2812FX_mode_chase_random(void) {
-	if(_counter_mode_step == 0) {
-		WS2812_setPixelColor32(_led_count-1, WS2812FX_color_wheel(_mode_color));
-		_mode_color = WS2812FX_get_random_wheel_index(_mode_color);
-	}
+void WS2812FX_mode_chase_random(const ws2812fx_time_t *t) {
+	uint32_t step_ms = 10 + ((30 * (uint32_t)(SPEED_MAX - _seg->speed)) / _seg->length);
+	uint32_t steps = WS2812FX_steps(t, step_ms);
 
-	for(uint16_t i=0; i < _counter_mode_step; i++) {
-		WS2812_setPixelColor32(i, WS2812FX_color_wheel(_mode_color));
+	if(WS2812FX_enterCycle(steps / _seg->length)) {
+		WS2812_setPixelColor32(_seg->length-1, WS2812FX_color_wheel(_seg->mode_color));
+		_seg->mode_color = WS2812FX_get_random_wheel_index(_seg->mode_color);
 	}
 
-	uint16_t n = _counter_mode_step;
-	uint16_t m = (_counter_mode_step + 1) % _led_count;
+	uint16_t n = steps % _seg->length;
+	uint16_t m = (n + 1) % _seg->length;
+	WS2812_fill(0, n, WS2812FX_color_wheel(_seg->mode_color));
 	WS2812_setPixelColor(n, 255, 255, 255);
 	WS2812_setPixelColor(m, 255, 255, 255);
 
 	WS2812_show();
 
-	_counter_mode_step = (_counter_mode_step + 1) % _led_count;
-	_mode_delay = 10 + ((30 * (uint32_t)(SPEED_MAX - _speed)) / _led_count);
+	_seg->mode_delay = step_ms;
 }
 
 
 /*
 * White running on rainbow.
 */
-void WS2812FX_mode_chase_rainbow(void) {
-	for(uint16_t i=0; i < _led_count; i++) {
-		WS2812_setPixelColor32(i, WS2812FX_color_wheel(((i * 256 / _led_count) + (_counter_mode_call % 256)) % 256));
-	}
+void WS2812FX_mode_chase_rainbow(const ws2812fx_time_t *t) {
+	uint32_t step_ms = 10 + ((30 * (uint32_t)(SPEED_MAX - _seg->speed)) / _seg->length);
+	uint32_t steps = WS2812FX_steps(t, step_ms);
+
+	WS2812FX_draw_rainbow(steps);
 
-	uint16_t n = _counter_mode_step;
-	uint16_t m = (_counter_mode_step + 1) % _led_count;
+	uint16_t n = steps % _seg->length;
+	uint16_t m = (n + 1) % _seg->length;
 	WS2812_setPixelColor(n, 255, 255, 255);
 	WS2812_setPixelColor(m, 255, 255, 255);
 	WS2812_show();
 
-	_counter_mode_step = (_counter_mode_step + 1) % _led_count;
-	_mode_delay = 10 + ((30 * (uint32_t)(SPEED_MAX - _speed)) / _led_count);
+	_seg->mode_delay = step_ms;
 }
 
 
 /*
-* White flashes running on _color.
+* Time within a chase_flash cycle: flash_count flashes of 20 ms on and
+* 30 ms off at one position, then step_ms without flash before the flashes
+* move on by one pixel. Returns the position, sets *on while a flash is
+* lit and sets the mode delay to the next change.
 */
-void WS2812FX_mode_chase_flash(void) {
-	const static uint8_t flash_count = 4;
-	uint8_t flash_step = _counter_mode_call % ((flash_count * 2) + 1);
-
-	for(uint16_t i=0; i < _led_count; i++) {
-		WS2812_setPixelColor32(i, _color);
+static uint16_t WS2812FX_chase_flash_step(const ws2812fx_time_t *t, uint32_t step_ms, uint32_t *cycle, bool *on) {
+	const uint8_t flash_count = 4;
+	uint32_t flash_ms = flash_count * 50;
+	uint32_t cycle_ms = flash_ms + step_ms;
+	uint32_t phase = t->elapsed_ms % cycle_ms;
+
+	*cycle = t->elapsed_ms / cycle_ms;
+	*on = false;
+	if(phase < flash_ms) {
+		uint32_t flash = phase % 50;
+		*on = flash < 20;
+		_seg->mode_delay = *on ? 20 - flash : 50 - flash;
+	} else {
+		_seg->mode_delay = cycle_ms - phase;
 	}
+	return *cycle % _seg->length;
+}
 
-	if(flash_step < (flash_count * 2)) {
-		if(flash_step % 2 == 0) {
-			uint16_t n = _counter_mode_step;
-			uint16_t m = (_counter_mode_step + 1) % _led_count;
-			WS2812_setPixelColor(n, 255, 255, 255);
-			WS2812_setPixelColor(m, 255, 255, 255);
-			_mode_delay = 20;
-		} else {
-			_mode_delay = 30;
-		}
-	} else {
-		_counter_mode_step = (_counter_mode_step + 1) % _led_count;
-		_mode_delay = 10 + ((30 * (uint32_t)(SPEED_MAX - _speed)) / _led_count);
+/*
+* White flashes running on _color.
+*/
+void WS2812FX_mode_chase_flash(const ws2812fx_time_t *t) {
+	uint32_t step_ms = 10 + ((30 * (uint32_t)(SPEED_MAX - _seg->speed)) / _seg->length);
+	uint32_t cycle;
+	bool on;
+	uint16_t n = WS2812FX_chase_flash_step(t, step_ms, &cycle, &on);
+
+	WS2812_fill(0, _seg->length, _seg->color);
+	if(on) {
+		uint16_t m = (n + 1) % _seg->length;
+		WS2812_setPixelColor(n, 255, 255, 255);
+		WS2812_setPixelColor(m, 255, 255, 255);
 	}
 
 	WS2812_show();
@@ -995,33 +2546,24 @@ void WS2812FX_mode_chase_flash(void) {
 /*
 * White flashes running, followed by random color.
 */
-void WS2812FX_mode_chase_flash_random(void) {
-	const static uint8_t flash_count = 4;
-	uint8_t flash_step = _counter_mode_call % ((flash_count * 2) + 1);
+void WS2812FX_mode_chase_flash_random(const ws2812fx_time_t *t) {
+	uint32_t step_ms = 1 + ((10 * (uint32_t)(SPEED_MAX - _seg->speed)) / _seg->length);
+	uint32_t cycle;
+	bool on;
+	uint16_t n = WS2812FX_chase_flash_step(t, step_ms, &cycle, &on);
+	uint16_t m = (n + 1) % _seg->length;
 
-	for(uint16_t i=0; i < _counter_mode_step; i++) {
-		WS2812_setPixelColor32(i, WS2812FX_color_wheel(_mode_color));
+	if(WS2812FX_enterCycle(cycle / _seg->length)) {
+		_seg->mode_color = WS2812FX_get_random_wheel_index(_seg->mode_color);
 	}
 
-	if(flash_step < (flash_count * 2)) {
-		uint16_t n = _counter_mode_step;
-		uint16_t m = (_counter_mode_step + 1) % _led_count;
-		if(flash_step % 2 == 0) {
-			WS2812_setPixelColor(n, 255, 255, 255);
-			WS2812_setPixelColor(m, 255, 255, 255);
-			_mode_delay = 20;
-		} else {
-			WS2812_setPixelColor32(n, WS2812FX_color_wheel(_mode_color));
-			WS2812_setPixelColor(m, 0, 0, 0);
-			_mode_delay = 30;
-		}
+	WS2812_fill(0, n, WS2812FX_color_wheel(_seg->mode_color));
+	if(on) {
+		WS2812_setPixelColor(n, 255, 255, 255);
+		WS2812_setPixelColor(m, 255, 255, 255);
 	} else {
-		_counter_mode_step = (_counter_mode_step + 1) % _led_count;
-		_mode_delay = 1 + ((10 * (uint32_t)(SPEED_MAX - _speed)) / _led_count);
-
-		if(_counter_mode_step == 0) {
-			_mode_color = WS2812FX_get_random_wheel_index(_mode_color);
-		}
+		WS2812_setPixelColor32(n, WS2812FX_color_wheel(_seg->mode_color));
+		WS2812_setPixelColor(m, 0, 0, 0);
 	}
 
 	WS2812_show();
@@ -1031,538 +2573,516 @@ void WS2812FX_mode_chase_flash_random(void) {
 /*
 * Rainbow running on white.
 */
-void WS2812FX_mode_chase_rainbow_white(void) {
-	for(uint16_t i=0; i < _led_count; i++) {
-		WS2812_setPixelColor(i, 255, 255, 255);
-	}
+void WS2812FX_mode_chase_rainbow_white(const ws2812fx_time_t *t) {
+	uint32_t step_ms = 10 + ((30 * (uint32_t)(SPEED_MAX - _seg->speed)) / _seg->length);
+	uint32_t steps = WS2812FX_steps(t, step_ms);
 
-	uint16_t n = _counter_mode_step;
-	uint16_t m = (_counter_mode_step + 1) % _led_count;
-	WS2812_setPixelColor32(n, WS2812FX_color_wheel(((n * 256 / _led_count) + (_counter_mode_call % 256)) % 256));
-	WS2812_setPixelColor32(m, WS2812FX_color_wheel(((m * 256 / _led_count) + (_counter_mode_call % 256)) % 256));
+	WS2812_fill(0, _seg->length, 0xFFFFFF);
+
+	uint16_t n = steps % _seg->length;
+	uint16_t m = (n + 1) % _seg->length;
+	const uint8_t *hue_steps = WS2812FX_hue_steps();
+	if(hue_steps) {
+		WS2812_setPixelColor32(n, WS2812FX_wheel(hue_steps[n] + steps));
+		WS2812_setPixelColor32(m, WS2812FX_wheel(hue_steps[m] + steps));
+	}
 	WS2812_show();
 
-	_counter_mode_step = (_counter_mode_step + 1) % _led_count;
-	_mode_delay = 10 + ((30 * (uint32_t)(SPEED_MAX - _speed)) / _led_count);
+	_seg->mode_delay = step_ms;
 }
 
 
 /*
 * Black running on _color.
 */
-void WS2812FX_mode_chase_blackout(void) {
-	for(uint16_t i=0; i < _led_count; i++) {
-		WS2812_setPixelColor32(i, _color);
-	}
+void WS2812FX_mode_chase_blackout(const ws2812fx_time_t *t) {
+	uint32_t step_ms = 10 + ((30 * (uint32_t)(SPEED_MAX - _seg->speed)) / _seg->length);
+	uint32_t steps = WS2812FX_steps(t, step_ms);
+
+	WS2812_fill(0, _seg->length, _seg->color);
 
-	uint16_t n = _counter_mode_step;
-	uint16_t m = (_counter_mode_step + 1) % _led_count;
+	uint16_t n = steps % _seg->length;
+	uint16_t m = (n + 1) % _seg->length;
 	WS2812_setPixelColor(n, 0, 0, 0);
 	WS2812_setPixelColor(m, 0, 0, 0);
 	WS2812_show();
 
-	_counter_mode_step = (_counter_mode_step + 1) % _led_count;
-	_mode_delay = 10 + ((30 * (uint32_t)(SPEED_MAX - _speed)) / _led_count);
+	_seg->mode_delay = step_ms;
 }
 
 
 /*
 * Black running on rainbow.
 */
-void WS2812FX_mode_chase_blackout_rainbow(void) {
-	for(uint16_t i=0; i < _led_count; i++) {
-		WS2812_setPixelColor32(i, WS2812FX_color_wheel(((i * 256 / _led_count) + (_counter_mode_call % 256)) % 256));
-	}
+void WS2812FX_mode_chase_blackout_rainbow(const ws2812fx_time_t *t) {
+	uint32_t step_ms = 10 + ((30 * (uint32_t)(SPEED_MAX - _seg->speed)) / _seg->length);
+	uint32_t steps = WS2812FX_steps(t, step_ms);
+
+	WS2812FX_draw_rainbow(steps);
 
-	uint16_t n = _counter_mode_step;
-	uint16_t m = (_counter_mode_step + 1) % _led_count;
+	uint16_t n = steps % _seg->length;
+	uint16_t m = (n + 1) % _seg->length;
 	WS2812_setPixelColor(n, 0, 0, 0);
 	WS2812_setPixelColor(m, 0, 0, 0);
 	WS2812_show();
 
-	_counter_mode_step = (_counter_mode_step + 1) % _led_count;
-	_mode_delay = 10 + ((30 * (uint32_t)(SPEED_MAX - _speed)) / _led_count);
+	_seg->mode_delay = step_ms;
 }
 
 
 /*
 * Random color intruduced alternating from start and end of strip.
 */
-void WS2812FX_mode_color_sweep_random(void) {
-	if(_counter_mode_step == 0 || _counter_mode_step == _led_count) {
-		_mode_color = WS2812FX_get_random_wheel_index(_mode_color);
+void WS2812FX_mode_color_sweep_random(const ws2812fx_time_t *t) {
+	uint32_t step_ms = 5 + ((50 * (uint32_t)(SPEED_MAX - _seg->speed)) / _seg->length);
+	uint32_t steps = WS2812FX_steps(t, step_ms);
+	uint32_t sweep = steps / _seg->length;
+	uint16_t n = steps % _seg->length;
+
+	if(WS2812FX_enterCycle(sweep)) {
+		_seg->mode_color = WS2812FX_get_random_wheel_index(_seg->mode_color);
 	}
 
-	if(_counter_mode_step < _led_count) {
-		WS2812_setPixelColor32(_counter_mode_step, WS2812FX_color_wheel(_mode_color));
+	if(sweep % 2 == 0) {
+		WS2812_fill(0, n + 1, WS2812FX_color_wheel(_seg->mode_color));
 	} else {
-		WS2812_setPixelColor32((_led_count * 2) - _counter_mode_step - 1, WS2812FX_color_wheel(_mode_color));
+		WS2812_fill(_seg->length - n - 1, n + 1, WS2812FX_color_wheel(_seg->mode_color));
 	}
 	WS2812_show();
 
-	_counter_mode_step = (_counter_mode_step + 1) % (_led_count * 2);
-	_mode_delay = 5 + ((50 * (uint32_t)(SPEED_MAX - _speed)) / _led_count);
+	_seg->mode_delay = step_ms;
 }
 
 
 /*
-* Alternating color/white pixels running.
+* Fills the strip with a repeating pattern of tile_len colors, pixel i
+* gets tile[(i + phase) % tile_len]. The rotated tile is built once and
+* then copied as whole spans.
 */
-void WS2812FX_mode_running_color(void) {
-	for(uint16_t i=0; i < _led_count; i++) {
-		if((i + _counter_mode_step) % 4 < 2) {
-			WS2812_setPixelColor32(i, _mode_color);
-		} else {
-			WS2812_setPixelColor(i, 255, 255, 255);
-		}
+void WS2812FX_draw_tile(const uint32_t *tile, uint8_t tile_len, uint8_t phase) {
+	uint32_t span[TILE_MAX_LENGTH];
+
+	tile_len = min(tile_len, TILE_MAX_LENGTH);
+	if(tile_len == 0) {
+		return;
+	}
+	for(uint8_t k=0; k < tile_len; k++) {
+		span[k] = tile[(k + phase) % tile_len];
 	}
-	WS2812_show();
 
-	_counter_mode_step = (_counter_mode_step + 1) % 4;
-	_mode_delay = 10 + ((30 * (uint32_t)(SPEED_MAX - _speed)) / _led_count);
+	WS2812FX_renderRanges(&WS2812FX_kernel_tile, NULL, tile_len, span);
 }
 
+/*
+* Range kernel of WS2812FX_draw_tile(), data is the rotated tile and arg
+* its length.
+*/
+void WS2812FX_kernel_tile(const ws2812fx_time_t *t, ws2812fx_range_t *range) {
+	const uint32_t *span = range->data;
+	uint8_t tile_len = range->arg;
+
+	for(uint16_t i=range->first; i < range->last; ) {
+		uint8_t k = i % tile_len;
+		uint16_t len = min(tile_len - k, range->last - i);
+		WS2812_writeRange(range, i, &span[k], len);
+		i += len;
+	}
+}
 
 /*
-* Alternating red/blue pixels running.
+* Runs a repeating pattern of tile_len colors along the strip, moved by
+* steps pixels since the mode was started. The whole pattern is only
+* drawn on the first call, after that the image is scrolled by the steps
+* passed since the last call and only the pixels coming in at the end
+* are drawn.
 */
-void WS2812FX_mode_running_red_blue(void) {
-	for(uint16_t i=0; i < _led_count; i++) {
-		if((i + _counter_mode_step) % 4 < 2) {
-			WS2812_setPixelColor(i, 255, 0, 0);
-		} else {
-			WS2812_setPixelColor(i, 0, 0, 255);
+void WS2812FX_running_tile(const uint32_t *tile, uint8_t tile_len, uint32_t steps) {
+	tile_len = min(tile_len, TILE_MAX_LENGTH);
+	if(tile_len == 0) {
+		return;
+	}
+
+	uint32_t delta = steps - _seg->counter_mode_step;
+	if(_seg->counter_mode_call == 1 || delta >= _seg->length) { // first call after a reset, see WS2812FX_service()
+		WS2812FX_draw_tile(tile, tile_len, steps % tile_len);
+	} else if(delta > 0) {
+		WS2812_scroll(-(int16_t)delta);
+		for(uint16_t i=_seg->length - delta; i < _seg->length; i++) {
+			WS2812_setPixelColor32(i, tile[(i + steps) % tile_len]);
 		}
 	}
 	WS2812_show();
 
-	_counter_mode_step = (_counter_mode_step + 1) % 4;
-	_mode_delay = 100 + ((100 * (uint32_t)(SPEED_MAX - _speed)) / _led_count);
+	_seg->counter_mode_step = steps;
 }
 
 
 /*
-* Random colored pixels running.
+* Runs the tile pattern selected with WS2812FX_setTile().
 */
-void WS2812FX_mode_running_random(void) {
-	for(uint16_t i=_led_count-1; i > 0; i--) {
-		WS2812_setPixelColor32(i, WS2812_getPixelColor(i-1));
-	}
-
-	if(_counter_mode_step == 0) {
-		_mode_color = WS2812FX_get_random_wheel_index(_mode_color);
-		WS2812_setPixelColor32(0, WS2812FX_color_wheel(_mode_color));
+void WS2812FX_mode_tile(const ws2812fx_time_t *t) {
+	if(atomic_load_explicit(&_tile_count, memory_order_acquire) == 0) {
+		WS2812FX_mode_static(t);
+		return;
 	}
 
-	WS2812_show();
+	uint32_t step_ms = 100 + ((100 * (uint32_t)(SPEED_MAX - _seg->speed)) / _seg->length);
 
-	_counter_mode_step = (_counter_mode_step + 1) % 2;
+	ws2812fx_tile_t *tile = &_tiles[_seg->tile_index];
+	WS2812FX_running_tile(tile->colors, tile->length, WS2812FX_steps(t, step_ms));
 
-	_mode_delay = 50 + ((50 * (uint32_t)(SPEED_MAX - _speed)) / _led_count);
+	_seg->mode_delay = step_ms;
 }
 
 
 /*
-* K.I.T.T.
+* Alternating color/white pixels running.
 */
-void WS2812FX_mode_larson_scanner(void) {
+void WS2812FX_mode_running_color(const ws2812fx_time_t *t) {
+	const uint32_t tile[] = { _seg->mode_color, _seg->mode_color, 0xFFFFFF, 0xFFFFFF };
+	uint32_t step_ms = 10 + ((30 * (uint32_t)(SPEED_MAX - _seg->speed)) / _seg->length);
+	WS2812FX_running_tile(tile, sizeof(tile)/sizeof(uint32_t), WS2812FX_steps(t, step_ms));
 
-	for(uint16_t i=0; i < _led_count; i++) {
-		uint32_t px_rgb = WS2812_getPixelColor(i);
+	_seg->mode_delay = step_ms;
+}
 
-		uint8_t px_r = (px_rgb & 0x00FF0000) >> 16;
-		uint8_t px_g = (px_rgb & 0x0000FF00) >>  8;
-		uint8_t px_b = (px_rgb & 0x000000FF) >>  0;
 
-		// fade out (divide by 2)
-		px_r = px_r >> 1;
-		px_g = px_g >> 1;
-		px_b = px_b >> 1;
+/*
+* Alternating red/blue pixels running.
+*/
+void WS2812FX_mode_running_red_blue(const ws2812fx_time_t *t) {
+	const uint32_t tile[] = { 0xFF0000, 0xFF0000, 0x0000FF, 0x0000FF };
+	uint32_t step_ms = 100 + ((100 * (uint32_t)(SPEED_MAX - _seg->speed)) / _seg->length);
+	WS2812FX_running_tile(tile, sizeof(tile)/sizeof(uint32_t), WS2812FX_steps(t, step_ms));
 
-		WS2812_setPixelColor(i, px_r, px_g, px_b);
-	}
+	_seg->mode_delay = step_ms;
+}
 
-	uint16_t pos = 0;
 
-	if(_counter_mode_step < _led_count) {
-		pos = _counter_mode_step;
-	} else {
-		pos = (_led_count * 2) - _counter_mode_step - 2;
+/*
+* Random colored pixels running.
+*/
+void WS2812FX_mode_running_random(const ws2812fx_time_t *t) {
+	uint32_t step_ms = 50 + ((50 * (uint32_t)(SPEED_MAX - _seg->speed)) / _seg->length);
+	uint32_t steps = WS2812FX_steps(t, step_ms) + 1;	// the first call moves once
+
+	// every other pixel coming in gets a new color, its neighbour repeats it
+	uint32_t delta = steps - _seg->counter_mode_step;
+	if(delta > _seg->length) {
+		delta = _seg->length;
+	}
+	for(uint32_t step=steps - delta; step < steps; step++) {
+		uint32_t first = WS2812_getPixelColor(0);
+		WS2812_scroll(1);
+		if(step % 2 == 0) {
+			_seg->mode_color = WS2812FX_get_random_wheel_index(_seg->mode_color);
+			WS2812_setPixelColor32(0, WS2812FX_color_wheel(_seg->mode_color));
+		} else {
+			WS2812_setPixelColor32(0, first);
+		}
 	}
-
-	WS2812_setPixelColor32(pos, _color);
 	WS2812_show();
 
-	_counter_mode_step = (_counter_mode_step + 1) % ((_led_count * 2) - 2);
-	_mode_delay = 10 + ((10 * (uint32_t)(SPEED_MAX - _speed)) / _led_count);
+	_seg->counter_mode_step = steps;
+	_seg->mode_delay = step_ms;
 }
 
 
 /*
-* Fireing comets from one end.
+* K.I.T.T.
 */
-void WS2812FX_mode_comet(void) {
-
-	for(uint16_t i=0; i < _led_count; i++) {
-		uint32_t px_rgb = WS2812_getPixelColor(i);
-
-		uint8_t px_r = (px_rgb & 0x00FF0000) >> 16;
-		uint8_t px_g = (px_rgb & 0x0000FF00) >>  8;
-		uint8_t px_b = (px_rgb & 0x000000FF) >>  0;
-
-		// fade out (divide by 2)
-		px_r = px_r >> 1;
-		px_g = px_g >> 1;
-		px_b = px_b >> 1;
+void WS2812FX_mode_larson_scanner(const ws2812fx_time_t *t) {
+	uint32_t step_ms = 10 + ((10 * (uint32_t)(SPEED_MAX - _seg->speed)) / _seg->length);
+	uint16_t period = max((_seg->length * 2) - 2, 1);
+	uint16_t step = WS2812FX_steps(t, step_ms) % period;
 
-		WS2812_setPixelColor(i, px_r, px_g, px_b);
-	}
+	WS2812_fade(128); // fade out (divide by 2)
 
-	WS2812_setPixelColor32(_counter_mode_step, _color);
+	uint16_t pos = (step < _seg->length) ? step : period - step;
+	WS2812_setPixelColor32(pos, _seg->color);
 	WS2812_show();
 
-	_counter_mode_step = (_counter_mode_step + 1) % _led_count;
-	_mode_delay = 10 + ((10 * (uint32_t)(SPEED_MAX - _speed)) / _led_count);
+	_seg->mode_delay = step_ms;
 }
 
 
 /*
-* Firework sparks.
+* Fireing comets from one end.
 */
-void WS2812FX_mode_fireworks(void) {
-	uint32_t px_rgb = 0;
-	uint8_t px_r = 0;
-	uint8_t px_g = 0;
-	uint8_t px_b = 0;
-
-	for(uint16_t i=0; i < _led_count; i++) {
-		px_rgb = WS2812_getPixelColor(i);
-
-		px_r = (px_rgb & 0x00FF0000) >> 16;
-		px_g = (px_rgb & 0x0000FF00) >>  8;
-		px_b = (px_rgb & 0x000000FF) >>  0;
+void WS2812FX_mode_comet(const ws2812fx_time_t *t) {
+	uint32_t step_ms = 10 + ((10 * (uint32_t)(SPEED_MAX - _seg->speed)) / _seg->length);
 
-		// fade out (divide by 2)
-		px_r = px_r >> 1;
-		px_g = px_g >> 1;
-		px_b = px_b >> 1;
+	WS2812_fade(128); // fade out (divide by 2)
 
-		WS2812_setPixelColor(i, px_r, px_g, px_b);
-	}
-
-	// first LED has only one neighbour
-	px_r = (((WS2812_getPixelColor(1) & 0x00FF0000) >> 16) >> 1) + ((WS2812_getPixelColor(0) & 0x00FF0000) >> 16);
-	px_g = (((WS2812_getPixelColor(1) & 0x0000FF00) >>  8) >> 1) + ((WS2812_getPixelColor(0) & 0x0000FF00) >>  8);
-	px_b = (((WS2812_getPixelColor(1) & 0x000000FF) >>  0) >> 1) + ((WS2812_getPixelColor(0) & 0x000000FF) >>  0);
-	WS2812_setPixelColor(0, px_r, px_g, px_b);
+	WS2812_setPixelColor32(WS2812FX_steps(t, step_ms) % _seg->length, _seg->color);
+	WS2812_show();
 
-	// set brightness(i) = ((brightness(i-1)/2 + brightness(i+1)) / 2) + brightness(i)
-	for(uint16_t i=1; i < _led_count-1; i++) {
-		px_r = ((
-			(((WS2812_getPixelColor(i-1) & 0x00FF0000) >> 16) >> 1) +
-				(((WS2812_getPixelColor(i+1) & 0x00FF0000) >> 16) >> 0) ) >> 1) +
-					(((WS2812_getPixelColor(i  ) & 0x00FF0000) >> 16) >> 0);
+	_seg->mode_delay = step_ms;
+}
 
-		px_g = ((
-			(((WS2812_getPixelColor(i-1) & 0x0000FF00) >> 8) >> 1) +
-				(((WS2812_getPixelColor(i+1) & 0x0000FF00) >> 8) >> 0) ) >> 1) +
-					(((WS2812_getPixelColor(i  ) & 0x0000FF00) >> 8) >> 0);
 
-		px_b = ((
-			(((WS2812_getPixelColor(i-1) & 0x000000FF) >> 0) >> 1) +
-				(((WS2812_getPixelColor(i+1) & 0x000000FF) >> 0) >> 0) ) >> 1) +
-					(((WS2812_getPixelColor(i  ) & 0x000000FF) >> 0) >> 0);
+/*
+* Firework sparks. Every frame the light of all sparks fades and spreads
+* to the neighbouring pixels, then new sparks are lit at random places.
+*/
+void WS2812FX_mode_fireworks(const ws2812fx_time_t *t) {
+	WS2812_diffuse(128, 48); // keep half, give 3/16 to each neighbour
 
-		WS2812_setPixelColor(i, px_r, px_g, px_b);
+	// _spark_density is in sparks per 1000 LEDs and frame
+	uint32_t expected = (uint32_t)_seg->length * _fx->spark_density;
+	uint32_t sparks = expected / 1000;
+	if(randomInRange(0, 1000) < expected % 1000) {
+		sparks++;
 	}
 
-	// last LED has only one neighbour
-	px_r = (((WS2812_getPixelColor(_led_count-2) & 0x00FF0000) >> 16) >> 2) + ((WS2812_getPixelColor(_led_count-1) & 0x00FF0000) >> 16);
-	px_g = (((WS2812_getPixelColor(_led_count-2) & 0x0000FF00) >>  8) >> 2) + ((WS2812_getPixelColor(_led_count-1) & 0x0000FF00) >>  8);
-	px_b = (((WS2812_getPixelColor(_led_count-2) & 0x000000FF) >>  0) >> 2) + ((WS2812_getPixelColor(_led_count-1) & 0x000000FF) >>  0);
-	WS2812_setPixelColor(_led_count-1, px_r, px_g, px_b);
-
-	for(uint16_t i=0; i<max(1,_led_count/20); i++) {
-		if(randomInRange(0, 10) == 0) {
-			WS2812_setPixelColor32(randomInRange(0, _led_count), _mode_color);
-		}
+	for(uint32_t i=0; i < sparks; i++) {
+		uint16_t n = randomInRange(0, _seg->length);
+		WS2812_setPixelColor32(n, WS2812FX_qadd32(WS2812_getPixelColor(n), _seg->mode_color));
 	}
 
 	WS2812_show();
 
-	_mode_delay = 20 + ((20 * (uint32_t)(SPEED_MAX - _speed)) / _led_count);
+	_seg->mode_delay = 20 + ((20 * (uint32_t)(SPEED_MAX - _seg->speed)) / _seg->length);
 }
 
 
 /*
 * Random colored firework sparks.
 */
-void WS2812FX_mode_fireworks_random(void) {
-	_mode_color = WS2812FX_color_wheel(randomInRange(0, 256));
-	WS2812FX_mode_fireworks();
+void WS2812FX_mode_fireworks_random(const ws2812fx_time_t *t) {
+	_seg->mode_color = WS2812FX_color_wheel(randomInRange(0, 256));
+	WS2812FX_mode_fireworks(t);
 }
 
 
 /*
 * Alternating red/green pixels running.
 */
-void WS2812FX_mode_merry_christmas(void) {
-	for(uint16_t i=0; i < _led_count; i++) {
-		if((i + _counter_mode_step) % 4 < 2) {
-			WS2812_setPixelColor(i, 255, 0, 0);
-		} else {
-			WS2812_setPixelColor(i, 0, 255, 0);
-		}
-	}
-	WS2812_show();
+void WS2812FX_mode_merry_christmas(const ws2812fx_time_t *t) {
+	const uint32_t tile[] = { 0xFF0000, 0xFF0000, 0x00FF00, 0x00FF00 };
+	uint32_t step_ms = 100 + ((100 * (uint32_t)(SPEED_MAX - _seg->speed)) / _seg->length);
+	WS2812FX_running_tile(tile, sizeof(tile)/sizeof(uint32_t), WS2812FX_steps(t, step_ms));
 
-	_counter_mode_step = (_counter_mode_step + 1) % 4;
-	_mode_delay = 100 + ((100 * (uint32_t)(SPEED_MAX - _speed)) / _led_count);
+	_seg->mode_delay = step_ms;
 }
 
 /*
 * Alternating red/green pixels running.
 */
-void WS2812FX_mode_halloween(void) {
-	for(uint16_t i=0; i < _led_count; i++) {
-		if((i + _counter_mode_step) % 4 < 2) {
-			WS2812_setPixelColor(i, 255, 0, 130);
-		} else {
-			WS2812_setPixelColor(i, 255, 50, 0);
-		}
-	}
-	WS2812_show();
+void WS2812FX_mode_halloween(const ws2812fx_time_t *t) {
+	const uint32_t tile[] = { 0xFF0082, 0xFF0082, 0xFF3200, 0xFF3200 };
+	uint32_t step_ms = 100 + ((100 * (uint32_t)(SPEED_MAX - _seg->speed)) / _seg->length);
+	WS2812FX_running_tile(tile, sizeof(tile)/sizeof(uint32_t), WS2812FX_steps(t, step_ms));
 
-	_counter_mode_step = (_counter_mode_step + 1) % 4;
-	_mode_delay = 100 + ((100 * (uint32_t)(SPEED_MAX - _speed)) / _led_count);
+	_seg->mode_delay = step_ms;
 }
 
 /*
 * Random flickering.
 */
-void WS2812FX_mode_fire_flicker(void) {
-	WS2812FX_mode_fire_flicker_int(3);
+void WS2812FX_mode_fire_flicker(const ws2812fx_time_t *t) {
+	WS2812FX_mode_fire_flicker_int(t, 3);
 }
 
 /*
 * Random flickering, less intesity.
 */
-void WS2812FX_mode_fire_flicker_soft(void) {
-	WS2812FX_mode_fire_flicker_int(6);
+void WS2812FX_mode_fire_flicker_soft(const ws2812fx_time_t *t) {
+	WS2812FX_mode_fire_flicker_int(t, 6);
 }
 
-void WS2812FX_mode_fire_flicker_intense(void) {
-	WS2812FX_mode_fire_flicker_int(1.7);
+void WS2812FX_mode_fire_flicker_intense(const ws2812fx_time_t *t) {
+	WS2812FX_mode_fire_flicker_int(t, 1.7);
 }
 
-void WS2812FX_mode_fire_flicker_int(int rev_intensity)
+void WS2812FX_mode_fire_flicker_int(const ws2812fx_time_t *t, int rev_intensity)
 {
-	uint8_t p_r = (_color & 0x00FF0000) >> 16;
-	uint8_t p_g = (_color & 0x0000FF00) >>  8;
-	uint8_t p_b = (_color & 0x000000FF) >>  0;
-	uint8_t flicker_val = max(p_r,max(p_g, p_b))/rev_intensity;
-	for(uint16_t i=0; i < _led_count; i++)
-	{
-		int flicker = randomInRange(0, flicker_val);
-		int r1 = p_r-flicker;
-		int g1 = p_g-flicker;
-		int b1 = p_b-flicker;
-		if(g1<0) g1=0;
-		if(r1<0) r1=0;
-		if(b1<0) b1=0;
-		WS2812_setPixelColor(i,r1,g1, b1);
-	}
+	uint8_t p_r = (_seg->color & 0x00FF0000) >> 16;
+	uint8_t p_g = (_seg->color & 0x0000FF00) >>  8;
+	uint8_t p_b = (_seg->color & 0x000000FF) >>  0;
+	uint8_t p_w = (_seg->color & 0xFF000000) >> 24;
+	uint8_t flicker_val = max(max(p_r, p_w), max(p_g, p_b))/rev_intensity;
+
+	WS2812FX_renderRanges(&WS2812FX_kernel_fire_flicker, t, flicker_val, NULL);
 	WS2812_show();
-	_mode_delay = 10 + ((500 * (uint32_t)(SPEED_MAX - _speed)) / SPEED_MAX);
+	_seg->mode_delay = 10 + ((500 * (uint32_t)(SPEED_MAX - _seg->speed)) / SPEED_MAX);
 }
 
 /*
-* Lights all LEDs after each other up starting from the outer edges and
-* finishing in the middle. Then turns them in reverse order off. Repeat.
+* Range kernel of the fire_flicker modes, arg is the maximum flicker.
 */
-void WS2812FX_mode_dual_color_wipe_in_out(void) {
-	int end = _led_count - _counter_mode_step - 1;
-	bool odd = (_led_count % 2);
-	int mid = odd ? ((_led_count / 2) + 1) : (_led_count / 2);
-	if (_counter_mode_step < mid) {
-		WS2812_setPixelColor32(_counter_mode_step, _color);
-		WS2812_setPixelColor32(end, _color);
-	}
-	else {
-		if (odd) {
-			// If odd, we need to 'double count' the center LED (once to turn it on,
-			// once to turn it off). So trail one behind after the middle LED.
-			WS2812_setPixelColor32(_counter_mode_step - 1, 0);
-			WS2812_setPixelColor32(end + 1, 0);
-		} else {
-			WS2812_setPixelColor32(_counter_mode_step, 0);
-			WS2812_setPixelColor32(end, 0);
-		}
-	}
-
-	_counter_mode_step++;
-	if (odd) {
-		if (_counter_mode_step > _led_count) {
-			_counter_mode_step = 0;
-		}
-	} else {
-		if (_counter_mode_step >= _led_count) {
-			_counter_mode_step = 0;
+void WS2812FX_kernel_fire_flicker(const ws2812fx_time_t *t, ws2812fx_range_t *range)
+{
+	uint32_t color = range->seg->color;
+	uint8_t p_r = (color & 0x00FF0000) >> 16;
+	uint8_t p_g = (color & 0x0000FF00) >>  8;
+	uint8_t p_b = (color & 0x000000FF) >>  0;
+	uint8_t p_w = (color & 0xFF000000) >> 24;
+	uint8_t noise[32];
+	uint32_t span[32];
+
+	for(uint16_t i=range->first; i < range->last; i += 32)
+	{
+		uint16_t len = min(32, range->last - i);
+		randomFill(range->fx, &range->random, noise, len);
+		for(uint16_t k=0; k < len; k++)
+		{
+			uint8_t flicker = WS2812FX_scale8(noise[k], range->arg);
+			uint8_t r1 = (p_r > flicker) ? p_r - flicker : 0;
+			uint8_t g1 = (p_g > flicker) ? p_g - flicker : 0;
+			uint8_t b1 = (p_b > flicker) ? p_b - flicker : 0;
+			uint8_t w1 = (p_w > flicker) ? p_w - flicker : 0;
+			span[k] = color32w(r1, g1, b1, w1);
 		}
+		WS2812_writeRange(range, i, span, len);
 	}
+}
 
-	WS2812_show();
+/*
+* Draws the k + 1 pixels next to each edge of the segment in color and
+* the others in rest.
+*/
+static void WS2812FX_draw_edges(uint16_t k, uint32_t color, uint32_t rest) {
+	WS2812FX_draw_band(k + 1, _seg->length - k - 1, rest, color);
+}
 
-	_mode_delay = 5 + ((50 * (uint32_t)(SPEED_MAX - _speed)) / _led_count);
+/*
+* Draws the k + 1 pixels on each side of the middle of the segment in
+* color and the others in rest. On an odd length they share the middle one.
+*/
+static void WS2812FX_draw_middle(uint16_t k, uint32_t color, uint32_t rest) {
+	uint16_t mid = _seg->length / 2;
+	uint16_t first = (_seg->length % 2) ? mid - k : mid - k - 1;
+	WS2812FX_draw_band(first, mid + k + 1, color, rest);
 }
 
 /*
-* Lights all LEDs after each other up starting from the outer edges and
-* finishing in the middle. Then turns them in that order off. Repeat.
+* Dual color wipe: the first half of the cycle lights the segment from the
+* edges or from the middle, the second half turns it off the same way.
 */
-void WS2812FX_mode_dual_color_wipe_in_in(void) {
-	bool odd = (_led_count % 2);
-	int mid = _led_count / 2;
-	if (odd) {
-		if (_counter_mode_step <= mid) {
-			WS2812_setPixelColor32(_counter_mode_step, _color);
-			WS2812_setPixelColor32(_led_count - _counter_mode_step - 1, _color);
+static void WS2812FX_dual_color_wipe(const ws2812fx_time_t *t, bool light_from_edges, bool clear_from_edges) {
+	uint32_t step_ms = 5 + ((50 * (uint32_t)(SPEED_MAX - _seg->speed)) / _seg->length);
+	uint16_t half = (_seg->length + 1) / 2;
+	uint16_t step = WS2812FX_steps(t, step_ms) % (half * 2);
+
+	if(step < half) {
+		if(light_from_edges) {
+			WS2812FX_draw_edges(step, _seg->color, 0);
 		} else {
-			int i = _counter_mode_step - mid;
-			WS2812_setPixelColor32(i - 1, 0);
-			WS2812_setPixelColor32(_led_count - i, 0);
+			WS2812FX_draw_middle(step, _seg->color, 0);
 		}
 	} else {
-		if (_counter_mode_step < mid) {
-			WS2812_setPixelColor32(_counter_mode_step, _color);
-			WS2812_setPixelColor32(_led_count - _counter_mode_step - 1, _color);
+		if(clear_from_edges) {
+			WS2812FX_draw_edges(step - half, 0, _seg->color);
 		} else {
-			int i = _counter_mode_step - mid;
-			WS2812_setPixelColor32(i, 0);
-			WS2812_setPixelColor32(_led_count - i - 1, 0);
+			WS2812FX_draw_middle(step - half, 0, _seg->color);
 		}
 	}
+	WS2812_show();
 
-	_counter_mode_step++;
-	if (odd) {
-		if (_counter_mode_step > _led_count) {
-			_counter_mode_step = 0;
-		}
-	} else {
-		if (_counter_mode_step >= _led_count) {
-			_counter_mode_step = 0;
-		}
-	}
+	_seg->mode_delay = step_ms;
+}
 
-	WS2812_show();
+/*
+* Lights all LEDs after each other up starting from the outer edges and
+* finishing in the middle. Then turns them in reverse order off. Repeat.
+*/
+void WS2812FX_mode_dual_color_wipe_in_out(const ws2812fx_time_t *t) {
+	WS2812FX_dual_color_wipe(t, true, false);
+}
 
-	_mode_delay = 5 + ((50 * (uint32_t)(SPEED_MAX - _speed)) / _led_count);
+/*
+* Lights all LEDs after each other up starting from the outer edges and
+* finishing in the middle. Then turns them in that order off. Repeat.
+*/
+void WS2812FX_mode_dual_color_wipe_in_in(const ws2812fx_time_t *t) {
+	WS2812FX_dual_color_wipe(t, true, true);
 }
 
 /*
 * Lights all LEDs after each other up starting from the middle and
 * finishing at the edges. Then turns them in that order off. Repeat.
 */
-void WS2812FX_mode_dual_color_wipe_out_out(void) {
-	int end = _led_count - _counter_mode_step - 1;
-	bool odd = (_led_count % 2);
-	int mid = _led_count / 2;
-
-	if (odd) {
-		if (_counter_mode_step <= mid) {
-			WS2812_setPixelColor32(mid + _counter_mode_step, _color);
-			WS2812_setPixelColor32(mid - _counter_mode_step, _color);
-		} else {
-			WS2812_setPixelColor32(_counter_mode_step - 1, 0);
-			WS2812_setPixelColor32(end + 1, 0);
-		}
-	} else {
-		if (_counter_mode_step < mid) {
-			WS2812_setPixelColor32(mid - _counter_mode_step - 1, _color);
-			WS2812_setPixelColor32(mid + _counter_mode_step, _color);
-		} else {
-			WS2812_setPixelColor32(_counter_mode_step, 0);
-			WS2812_setPixelColor32(end, 0);
-		}
-	}
+void WS2812FX_mode_dual_color_wipe_out_out(const ws2812fx_time_t *t) {
+	WS2812FX_dual_color_wipe(t, false, false);
+}
 
-	_counter_mode_step++;
-	if (odd) {
-		if (_counter_mode_step > _led_count) {
-			_counter_mode_step = 0;
-		}
-	} else {
-		if (_counter_mode_step >= _led_count) {
-			_counter_mode_step = 0;
-		}
-	}
+/*
+* Lights all LEDs after each other up starting from the middle and
+* finishing at the edges. Then turns them in reverse order off. Repeat.
+*/
+void WS2812FX_mode_dual_color_wipe_out_in(const ws2812fx_time_t *t) {
+	WS2812FX_dual_color_wipe(t, false, true);
+}
 
-	WS2812_show();
+/*
+* Alternating white/red/black pixels running.
+*/
+void WS2812FX_mode_circus_combustus(const ws2812fx_time_t *t) {
+	const uint32_t tile[] = { 0xFF0000, 0xFF0000, 0xFFFFFF, 0xFFFFFF, 0x000000, 0x000000 };
+	uint32_t step_ms = 100 + ((100 * (uint32_t)(SPEED_MAX - _seg->speed)) / _seg->length);
+	WS2812FX_running_tile(tile, sizeof(tile)/sizeof(uint32_t), WS2812FX_steps(t, step_ms));
 
-	_mode_delay = 5 + ((50 * (uint32_t)(SPEED_MAX - _speed)) / _led_count);
+	_seg->mode_delay = step_ms;
 }
 
 /*
-* Lights all LEDs after each other up starting from the middle and
-* finishing at the edges. Then turns them in reverse order off. Repeat.
+* Colors of the wheel running along the strip in sine shaped waves.
 */
-void WS2812FX_mode_dual_color_wipe_out_in(void) {
-	bool odd = (_led_count % 2);
-	int mid = _led_count / 2;
+void WS2812FX_mode_color_waves(const ws2812fx_time_t *t) {
+	uint32_t step_ms = 10 + ((50 * (uint32_t)(SPEED_MAX - _seg->speed)) / SPEED_MAX);
+	uint8_t phase = WS2812FX_steps(t, step_ms);
 
-	if (odd) {
-		if (_counter_mode_step <= mid) {
-			WS2812_setPixelColor32(mid + _counter_mode_step, _color);
-			WS2812_setPixelColor32(mid - _counter_mode_step, _color);
-		} else {
-			int i = _counter_mode_step - mid;
-			WS2812_setPixelColor32(i - 1, 0);
-			WS2812_setPixelColor32(_led_count - i, 0);
-		}
-	} else {
-		if (_counter_mode_step < mid) {
-			WS2812_setPixelColor32(mid - _counter_mode_step - 1, _color);
-			WS2812_setPixelColor32(mid + _counter_mode_step, _color);
-		} else {
-			int i = _counter_mode_step - mid;
-			WS2812_setPixelColor32(i, 0);
-			WS2812_setPixelColor32(_led_count - i - 1, 0);
-		}
-	}
+	WS2812FX_renderRanges(&WS2812FX_kernel_color_waves, t, phase, NULL);
+	WS2812_show();
 
-	_counter_mode_step++;
-	if (odd) {
-		if (_counter_mode_step > _led_count) {
-			_counter_mode_step = 0;
-		}
-	} else {
-		if (_counter_mode_step >= _led_count) {
-			_counter_mode_step = 0;
+	_seg->mode_delay = step_ms;
+}
+
+void WS2812FX_kernel_color_waves(const ws2812fx_time_t *t, ws2812fx_range_t *range) {
+	uint8_t phase = range->arg;
+	uint32_t span[32];
+
+	for(uint16_t i=range->first; i < range->last; i += 32) {
+		uint16_t len = min(32, range->last - i);
+		for(uint16_t k=0; k < len; k++) {
+			uint16_t n = i + k;
+			uint8_t hue = phase + (WS2812FX_sin8((n << 3) + phase) >> 1);
+			uint8_t level = 64 + WS2812FX_scale8(WS2812FX_sin8((n << 4) - (phase << 1)), 191);
+			span[k] = WS2812FX_scale32(WS2812FX_color_wheel(hue), level);
 		}
+		WS2812_writeRange(range, i, span, len);
 	}
+}
+
+/*
+* Two sine waves of different length running in opposite directions,
+* _color shows where they add up.
+*/
+void WS2812FX_mode_interference(const ws2812fx_time_t *t) {
+	uint32_t step_ms = 10 + ((50 * (uint32_t)(SPEED_MAX - _seg->speed)) / SPEED_MAX);
+	uint8_t phase = WS2812FX_steps(t, step_ms);
 
+	WS2812FX_renderRanges(&WS2812FX_kernel_interference, t, phase, NULL);
 	WS2812_show();
 
-	_mode_delay = 5 + ((50 * (uint32_t)(SPEED_MAX - _speed)) / _led_count);
+	_seg->mode_delay = step_ms;
 }
 
-/*
-* Alternating white/red/black pixels running.
-*/
-void WS2812FX_mode_circus_combustus(void) {
-	for(uint16_t i=0; i < _led_count; i++) {
-		if((i + _counter_mode_step) % 6 < 2) {
-			WS2812_setPixelColor(i, 255, 0, 0);
-		} else if((i + _counter_mode_step) % 6 < 4){
-			WS2812_setPixelColor(i, 255, 255, 255);
-		} else {
-			WS2812_setPixelColor(i, 0, 0, 0);
+void WS2812FX_kernel_interference(const ws2812fx_time_t *t, ws2812fx_range_t *range) {
+	uint8_t phase = range->arg;
+	uint32_t span[32];
+
+	for(uint16_t i=range->first; i < range->last; i += 32) {
+		uint16_t len = min(32, range->last - i);
+		for(uint16_t k=0; k < len; k++) {
+			uint16_t n = i + k;
+			uint16_t sum = WS2812FX_sin8((n * 7) + (phase << 1)) + WS2812FX_sin8((n * 11) - (phase * 3));
+			uint8_t level = sum >> 1;
+			span[k] = WS2812FX_scale32(range->seg->color, WS2812FX_scale8(level, level));
 		}
+		WS2812_writeRange(range, i, span, len);
 	}
-	WS2812_show();
-
-	_counter_mode_step = (_counter_mode_step + 1) % 6;
-	_mode_delay = 100 + ((100 * (uint32_t)(SPEED_MAX - _speed)) / _led_count);
 }
 
 void WS2812FX_initModes() {
@@ -1620,4 +3140,7 @@ void WS2812FX_initModes() {
 	_mode[FX_MODE_DUAL_COLOR_WIPE_OUT_IN]  = &WS2812FX_mode_dual_color_wipe_out_in;
 	_mode[FX_MODE_CIRCUS_COMBUSTUS]        = &WS2812FX_mode_circus_combustus;
 	_mode[FX_MODE_HALLOWEEN]               = &WS2812FX_mode_halloween;
+	_mode[FX_MODE_TILE]                    = &WS2812FX_mode_tile;
+	_mode[FX_MODE_COLOR_WAVES]             = &WS2812FX_mode_color_waves;
+	_mode[FX_MODE_INTERFERENCE]            = &WS2812FX_mode_interference;
 }
\ No newline at end of file
@@ -0,0 +1,285 @@
+/*
+WS2812FX_math.c - Fixed point pixel math for WS2812FX.
+
+The span kernels use GCC vector extensions to handle four pixels per
+operation on hosts with SIMD units. The ESP32 has none, so there the
+same SWAR expressions run on one 32 bit pixel at a time.
+
+LICENSE
+The MIT License (MIT), see WS2812FX.h
+*/
+
+#include "WS2812FX_math.h"
+#include <string.h>
+
+const uint8_t WS2812FX_sin8_table[256] = {
+	128, 131, 134, 137, 140, 144, 147, 150, 153, 156, 159, 162, 165, 168, 171, 174,
+	177, 179, 182, 185, 188, 191, 193, 196, 199, 201, 204, 206, 209, 211, 213, 216,
+	218, 220, 222, 224, 226, 228, 230, 232, 234, 235, 237, 239, 240, 241, 243, 244,
+	245, 246, 248, 249, 250, 250, 251, 252, 253, 253, 254, 254, 254, 255, 255, 255,
+	255, 255, 255, 255, 254, 254, 254, 253, 253, 252, 251, 250, 250, 249, 248, 246,
+	245, 244, 243, 241, 240, 239, 237, 235, 234, 232, 230, 228, 226, 224, 222, 220,
+	218, 216, 213, 211, 209, 206, 204, 201, 199, 196, 193, 191, 188, 185, 182, 179,
+	177, 174, 171, 168, 165, 162, 159, 156, 153, 150, 147, 144, 140, 137, 134, 131,
+	128, 125, 122, 119, 116, 112, 109, 106, 103, 100,  97,  94,  91,  88,  85,  82,
+	 79,  77,  74,  71,  68,  65,  63,  60,  57,  55,  52,  50,  47,  45,  43,  40,
+	 38,  36,  34,  32,  30,  28,  26,  24,  22,  21,  19,  17,  16,  15,  13,  12,
+	 11,  10,   8,   7,   6,   6,   5,   4,   3,   3,   2,   2,   2,   1,   1,   1,
+	  1,   1,   1,   1,   2,   2,   2,   3,   3,   4,   5,   6,   6,   7,   8,  10,
+	 11,  12,  13,  15,  16,  17,  19,  21,  22,  24,  26,  28,  30,  32,  34,  36,
+	 38,  40,  43,  45,  47,  50,  52,  55,  57,  60,  63,  65,  68,  71,  74,  77,
+	 79,  82,  85,  88,  91,  94,  97, 100, 103, 106, 109, 112, 116, 119, 122, 125
+};
+
+const int16_t WS2812FX_sin16_table[256] = {
+	     0,    804,   1608,   2410,   3212,   4011,   4808,   5602,
+	  6393,   7179,   7962,   8739,   9512,  10278,  11039,  11793,
+	 12539,  13279,  14010,  14732,  15446,  16151,  16846,  17530,
+	 18204,  18868,  19519,  20159,  20787,  21403,  22005,  22594,
+	 23170,  23731,  24279,  24811,  25329,  25832,  26319,  26790,
+	 27245,  27683,  28105,  28510,  28898,  29268,  29621,  29956,
+	 30273,  30571,  30852,  31113,  31356,  31580,  31785,  31971,
+	 32137,  32285,  32412,  32521,  32609,  32678,  32728,  32757,
+	 32767,  32757,  32728,  32678,  32609,  32521,  32412,  32285,
+	 32137,  31971,  31785,  31580,  31356,  31113,  30852,  30571,
+	 30273,  29956,  29621,  29268,  28898,  28510,  28105,  27683,
+	 27245,  26790,  26319,  25832,  25329,  24811,  24279,  23731,
+	 23170,  22594,  22005,  21403,  20787,  20159,  19519,  18868,
+	 18204,  17530,  16846,  16151,  15446,  14732,  14010,  13279,
+	 12539,  11793,  11039,  10278,   9512,   8739,   7962,   7179,
+	  6393,   5602,   4808,   4011,   3212,   2410,   1608,    804,
+	     0,   -804,  -1608,  -2410,  -3212,  -4011,  -4808,  -5602,
+	 -6393,  -7179,  -7962,  -8739,  -9512, -10278, -11039, -11793,
+	-12539, -13279, -14010, -14732, -15446, -16151, -16846, -17530,
+	-18204, -18868, -19519, -20159, -20787, -21403, -22005, -22594,
+	-23170, -23731, -24279, -24811, -25329, -25832, -26319, -26790,
+	-27245, -27683, -28105, -28510, -28898, -29268, -29621, -29956,
+	-30273, -30571, -30852, -31113, -31356, -31580, -31785, -31971,
+	-32137, -32285, -32412, -32521, -32609, -32678, -32728, -32757,
+	-32767, -32757, -32728, -32678, -32609, -32521, -32412, -32285,
+	-32137, -31971, -31785, -31580, -31356, -31113, -30852, -30571,
+	-30273, -29956, -29621, -29268, -28898, -28510, -28105, -27683,
+	-27245, -26790, -26319, -25832, -25329, -24811, -24279, -23731,
+	-23170, -22594, -22005, -21403, -20787, -20159, -19519, -18868,
+	-18204, -17530, -16846, -16151, -15446, -14732, -14010, -13279,
+	-12539, -11793, -11039, -10278,  -9512,  -8739,  -7962,  -7179,
+	 -6393,  -5602,  -4808,  -4011,  -3212,  -2410,  -1608,   -804
+};
+
+const uint32_t WS2812FX_wheel_table[256] = {
+	0xFF0000, 0xFC0300, 0xF90600, 0xF60900, 0xF30C00, 0xF00F00, 0xED1200, 0xEA1500,
+	0xE71800, 0xE41B00, 0xE11E00, 0xDE2100, 0xDB2400, 0xD82700, 0xD52A00, 0xD22D00,
+	0xCF3000, 0xCC3300, 0xC93600, 0xC63900, 0xC33C00, 0xC03F00, 0xBD4200, 0xBA4500,
+	0xB74800, 0xB44B00, 0xB14E00, 0xAE5100, 0xAB5400, 0xA85700, 0xA55A00, 0xA25D00,
+	0x9F6000, 0x9C6300, 0x996600, 0x966900, 0x936C00, 0x906F00, 0x8D7200, 0x8A7500,
+	0x877800, 0x847B00, 0x817E00, 0x7E8100, 0x7B8400, 0x788700, 0x758A00, 0x728D00,
+	0x6F9000, 0x6C9300, 0x699600, 0x669900, 0x639C00, 0x609F00, 0x5DA200, 0x5AA500,
+	0x57A800, 0x54AB00, 0x51AE00, 0x4EB100, 0x4BB400, 0x48B700, 0x45BA00, 0x42BD00,
+	0x3FC000, 0x3CC300, 0x39C600, 0x36C900, 0x33CC00, 0x30CF00, 0x2DD200, 0x2AD500,
+	0x27D800, 0x24DB00, 0x21DE00, 0x1EE100, 0x1BE400, 0x18E700, 0x15EA00, 0x12ED00,
+	0x0FF000, 0x0CF300, 0x09F600, 0x06F900, 0x03FC00, 0x00FF00, 0x00FC03, 0x00F906,
+	0x00F609, 0x00F30C, 0x00F00F, 0x00ED12, 0x00EA15, 0x00E718, 0x00E41B, 0x00E11E,
+	0x00DE21, 0x00DB24, 0x00D827, 0x00D52A, 0x00D22D, 0x00CF30, 0x00CC33, 0x00C936,
+	0x00C639, 0x00C33C, 0x00C03F, 0x00BD42, 0x00BA45, 0x00B748, 0x00B44B, 0x00B14E,
+	0x00AE51, 0x00AB54, 0x00A857, 0x00A55A, 0x00A25D, 0x009F60, 0x009C63, 0x009966,
+	0x009669, 0x00936C, 0x00906F, 0x008D72, 0x008A75, 0x008778, 0x00847B, 0x00817E,
+	0x007E81, 0x007B84, 0x007887, 0x00758A, 0x00728D, 0x006F90, 0x006C93, 0x006996,
+	0x006699, 0x00639C, 0x00609F, 0x005DA2, 0x005AA5, 0x0057A8, 0x0054AB, 0x0051AE,
+	0x004EB1, 0x004BB4, 0x0048B7, 0x0045BA, 0x0042BD, 0x003FC0, 0x003CC3, 0x0039C6,
+	0x0036C9, 0x0033CC, 0x0030CF, 0x002DD2, 0x002AD5, 0x0027D8, 0x0024DB, 0x0021DE,
+	0x001EE1, 0x001BE4, 0x0018E7, 0x0015EA, 0x0012ED, 0x000FF0, 0x000CF3, 0x0009F6,
+	0x0006F9, 0x0003FC, 0x0000FF, 0x0300FC, 0x0600F9, 0x0900F6, 0x0C00F3, 0x0F00F0,
+	0x1200ED, 0x1500EA, 0x1800E7, 0x1B00E4, 0x1E00E1, 0x2100DE, 0x2400DB, 0x2700D8,
+	0x2A00D5, 0x2D00D2, 0x3000CF, 0x3300CC, 0x3600C9, 0x3900C6, 0x3C00C3, 0x3F00C0,
+	0x4200BD, 0x4500BA, 0x4800B7, 0x4B00B4, 0x4E00B1, 0x5100AE, 0x5400AB, 0x5700A8,
+	0x5A00A5, 0x5D00A2, 0x60009F, 0x63009C, 0x660099, 0x690096, 0x6C0093, 0x6F0090,
+	0x72008D, 0x75008A, 0x780087, 0x7B0084, 0x7E0081, 0x81007E, 0x84007B, 0x870078,
+	0x8A0075, 0x8D0072, 0x90006F, 0x93006C, 0x960069, 0x990066, 0x9C0063, 0x9F0060,
+	0xA2005D, 0xA5005A, 0xA80057, 0xAB0054, 0xAE0051, 0xB1004E, 0xB4004B, 0xB70048,
+	0xBA0045, 0xBD0042, 0xC0003F, 0xC3003C, 0xC60039, 0xC90036, 0xCC0033, 0xCF0030,
+	0xD2002D, 0xD5002A, 0xD80027, 0xDB0024, 0xDE0021, 0xE1001E, 0xE4001B, 0xE70018,
+	0xEA0015, 0xED0012, 0xF0000F, 0xF3000C, 0xF60009, 0xF90006, 0xFC0003, 0xFF0000
+};
+
+#if defined(__GNUC__) && !defined(ESP_PLATFORM)
+#define WS2812FX_VECTOR 4
+typedef uint32_t pixel_vector_t __attribute__((vector_size(WS2812FX_VECTOR * sizeof(uint32_t))));
+
+static inline pixel_vector_t load_vector(const uint32_t *px) {
+	pixel_vector_t v;
+	memcpy(&v, px, sizeof(v));
+	return v;
+}
+
+static inline void store_vector(uint32_t *px, pixel_vector_t v) {
+	memcpy(px, &v, sizeof(v));
+}
+
+static inline pixel_vector_t scale_vector(pixel_vector_t c, uint32_t scale) {
+	pixel_vector_t rb = ((c & 0x00FF00FF) * scale) >> 8;
+	pixel_vector_t wg = ((c >> 8) & 0x00FF00FF) * scale;
+	return (rb & 0x00FF00FF) | (wg & 0xFF00FF00);
+}
+
+static inline pixel_vector_t qadd_vector(pixel_vector_t a, pixel_vector_t b) {
+	pixel_vector_t sum = (a & 0x7F7F7F7F) + (b & 0x7F7F7F7F);
+	sum ^= (a ^ b) & 0x80808080;
+	pixel_vector_t overflow = ((a & b) | ((a | b) & ~sum)) & 0x80808080;
+	return sum | ((overflow >> 7) * 0xFF);
+}
+#endif
+
+void WS2812FX_randomSeed(ws2812fx_random_t *rng, uint32_t seed) {
+	rng->state = seed ? seed : 0x2545F491;
+}
+
+/*
+* Unbiased random number in [0, range), see Lemire, "Fast Random Integer
+* Generation in an Interval". Usually costs one multiplication, the
+* division is only needed when the first draw lands in the biased part.
+*/
+uint32_t WS2812FX_randomRange(ws2812fx_random_t *rng, uint32_t range) {
+	uint64_t m = (uint64_t)WS2812FX_random32(rng) * range;
+	uint32_t low = (uint32_t)m;
+
+	if(low < range) {
+		uint32_t threshold = -range % range;
+		while(low < threshold) {
+			m = (uint64_t)WS2812FX_random32(rng) * range;
+			low = (uint32_t)m;
+		}
+	}
+	return m >> 32;
+}
+
+/*
+* Random hue at least distance steps away from hue in both directions
+* around the wheel, drawn in one step. distance is kept within 1 to 128,
+* so the result is never hue itself.
+*/
+uint8_t WS2812FX_randomDistantHue(ws2812fx_random_t *rng, uint8_t hue, uint8_t distance) {
+	distance = (distance > 128) ? 128 : ((distance < 1) ? 1 : distance);
+	return hue + distance + WS2812FX_randomRange(rng, 257 - (2 * distance));
+}
+
+/*
+* Fills buf with random bytes, four per generator step.
+*/
+void WS2812FX_randomBytes(ws2812fx_random_t *rng, uint8_t *buf, uint16_t len) {
+	while(len >= 4) {
+		uint32_t x = WS2812FX_random32(rng);
+		memcpy(buf, &x, 4);
+		buf += 4;
+		len -= 4;
+	}
+	if(len) {
+		uint32_t x = WS2812FX_random32(rng);
+		memcpy(buf, &x, len);
+	}
+}
+
+/*
+* HSV to packed RGB in fixed point. The hue circle is split into six
+* sectors of about 43 steps, s and v are 0 to 255.
+*/
+uint32_t WS2812FX_hsv2rgb(uint8_t h, uint8_t s, uint8_t v) {
+	if(s == 0) {
+		return ((uint32_t)v << 16) | ((uint32_t)v << 8) | v;
+	}
+
+	uint16_t h6 = (uint16_t)h * 6;
+	uint8_t sector = h6 >> 8;
+	uint8_t rest = h6 & 0xFF;
+
+	uint8_t p = WS2812FX_scale8(v, 255 - s);
+	uint8_t q = WS2812FX_scale8(v, 255 - WS2812FX_scale8(s, rest));
+	uint8_t t = WS2812FX_scale8(v, 255 - WS2812FX_scale8(s, 255 - rest));
+
+	uint8_t r, g, b;
+	switch(sector) {
+		case 0:  r = v; g = t; b = p; break;
+		case 1:  r = q; g = v; b = p; break;
+		case 2:  r = p; g = v; b = t; break;
+		case 3:  r = p; g = q; b = v; break;
+		case 4:  r = t; g = p; b = v; break;
+		default: r = v; g = p; b = q; break;
+	}
+	return ((uint32_t)r << 16) | ((uint32_t)g << 8) | b;
+}
+
+void WS2812FX_hsv2rgbSpan(const ws2812fx_hsv_t *hsv, uint32_t *rgb, uint16_t len) {
+	for(uint16_t i=0; i < len; i++) {
+		rgb[i] = WS2812FX_hsv2rgb(hsv[i].h, hsv[i].s, hsv[i].v);
+	}
+}
+
+/*
+* Scales every channel of len pixels by scale/256, 128 halves them.
+*/
+void WS2812FX_fadeSpan(uint32_t *px, uint16_t len, uint8_t scale) {
+	uint16_t i = 0;
+#ifdef WS2812FX_VECTOR
+	for(; i + WS2812FX_VECTOR <= len; i += WS2812FX_VECTOR) {
+		store_vector(&px[i], scale_vector(load_vector(&px[i]), scale));
+	}
+#endif
+	for(; i < len; i++) {
+		px[i] = WS2812FX_scale32(px[i], scale);
+	}
+}
+
+/*
+* Adds src to dst channel by channel, saturating at 255.
+*/
+void WS2812FX_addSpan(uint32_t *dst, const uint32_t *src, uint16_t len) {
+	uint16_t i = 0;
+#ifdef WS2812FX_VECTOR
+	for(; i + WS2812FX_VECTOR <= len; i += WS2812FX_VECTOR) {
+		store_vector(&dst[i], qadd_vector(load_vector(&dst[i]), load_vector(&src[i])));
+	}
+#endif
+	for(; i < len; i++) {
+		dst[i] = WS2812FX_qadd32(dst[i], src[i]);
+	}
+}
+
+/*
+* 3-tap diffusion in one linear sweep. Every pixel becomes keep/256 of
+* itself plus seep/256 of each neighbour, using the neighbour values from
+* before the sweep. Pixels outside the span count as black. With
+* keep + 2 * seep <= 256 the channels cannot overflow.
+*/
+void WS2812FX_diffuseSpan(uint32_t *px, uint16_t len, uint8_t keep, uint8_t seep) {
+	uint32_t left = 0;	// value of px[i - 1] before the sweep
+	uint16_t i = 0;
+
+#ifdef WS2812FX_VECTOR
+	for(; i + WS2812FX_VECTOR < len; i += WS2812FX_VECTOR) {
+		uint32_t shifted[WS2812FX_VECTOR];
+		shifted[0] = left;
+		memcpy(&shifted[1], &px[i], (WS2812FX_VECTOR - 1) * sizeof(uint32_t));
+
+		pixel_vector_t c = load_vector(&px[i]);
+		pixel_vector_t l = load_vector(shifted);
+		pixel_vector_t r = load_vector(&px[i + 1]);
+		left = px[i + WS2812FX_VECTOR - 1];
+
+		store_vector(&px[i], scale_vector(c, keep) + scale_vector(l, seep) + scale_vector(r, seep));
+	}
+#endif
+	for(; i < len; i++) {
+		uint32_t c = px[i];
+		uint32_t r = (i + 1 < len) ? px[i + 1] : 0;
+
+		px[i] = WS2812FX_scale32(c, keep) + WS2812FX_scale32(left, seep) + WS2812FX_scale32(r, seep);
+		left = c;
+	}
+}
+
+/*
+* 3-tap blur. Every pixel keeps (255 - amount)/256 of itself and gets
+* amount/512 of each neighbour.
+*/
+void WS2812FX_blurSpan(uint32_t *px, uint16_t len, uint8_t amount) {
+	WS2812FX_diffuseSpan(px, len, 255 - amount, amount >> 1);
+}
@@ -0,0 +1,208 @@
+/*
+WS2812FX_output.c - Target independent parts of the output backends.
+
+The wire order encoder, the memory backend and the SPI bit pattern
+encoder, all plain C so the encoding throughput can be measured on a host.
+
+LICENSE
+The MIT License (MIT), see WS2812FX.h
+*/
+
+#include "WS2812FX_output.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define ENCODE_PIXELS						32		// converted per call of the backend
+#define MAX_BYTES_PER_PIXEL					4
+
+/*
+* Sets up encoder for a strip with the given color order and 3 or 4 bytes
+* per pixel. The tables are built by the first frame.
+*/
+void WS2812FX_encoderInit(ws2812fx_encoder_t *encoder, ws2812fx_color_order_t order, uint8_t bytes_per_pixel) {
+	// bit positions of the bytes in wire order within a 0xRRGGBB color
+	static const uint8_t color_order_shifts[][3] = {
+		[WS2812FX_ORDER_GRB] = {  8, 16,  0 },
+		[WS2812FX_ORDER_RGB] = { 16,  8,  0 },
+		[WS2812FX_ORDER_BRG] = {  0, 16,  8 },
+		[WS2812FX_ORDER_RBG] = { 16,  0,  8 },
+		[WS2812FX_ORDER_GBR] = {  8,  0, 16 },
+		[WS2812FX_ORDER_BGR] = {  0,  8, 16 },
+	};
+
+	memset(encoder, 0, sizeof(ws2812fx_encoder_t));
+	memcpy(encoder->shifts, color_order_shifts[order], sizeof(encoder->shifts));
+	encoder->bytes_per_pixel = bytes_per_pixel;
+}
+
+void WS2812FX_buildGammaTable(ws2812fx_encoder_t *encoder, float gamma) {
+	for (uint16_t v = 0; v <= 255; v++) {
+		encoder->gamma_table[v] = (powf((float)v / 255, gamma) * UINT16_MAX) + 0.5;
+	}
+	encoder->gamma = gamma;
+	encoder->valid = false;
+}
+
+/*
+* Combines gamma and brightness into one table, so the output stage
+* costs a single lookup per channel.
+*/
+void WS2812FX_buildOutputTable(ws2812fx_encoder_t *encoder, uint8_t level) {
+	encoder->fractional = false;
+	for (uint16_t v = 0; v <= 255; v++) {
+		encoder->table[v] = (((uint32_t)encoder->gamma_table[v] * level * 256) + (UINT16_MAX / 2)) / UINT16_MAX;
+		if (encoder->table[v] & 0xFF) {
+			encoder->fractional = true;
+		}
+	}
+	encoder->level = level;
+	encoder->valid = true;
+}
+
+/*
+* Threshold of the next dither phase. The steps are bit reversed, which
+* spreads the rounded up frames evenly in time.
+*/
+uint8_t WS2812FX_nextDither(ws2812fx_encoder_t *encoder) {
+	static const uint8_t dither_thresholds[] = { 0, 128, 64, 192, 32, 160, 96, 224 };
+	encoder->dither_step = (encoder->dither_step + 1) % sizeof(dither_thresholds);
+	return dither_thresholds[encoder->dither_step];
+}
+
+/*
+* Gamma and brightness corrected 8 bit value. The fractional part is
+* rounded up on a share of the frames given by the dither threshold,
+* so it shows up as a time average instead of being dropped. It is also
+* collected in fraction.
+*/
+static inline uint8_t WS2812FX_output(const ws2812fx_encoder_t *encoder, uint8_t v, uint8_t threshold, uint16_t *fraction) {
+	uint16_t level = encoder->table[v];
+	*fraction |= level;
+	return (level + threshold) >> 8;
+}
+
+static inline uint8_t WS2812FX_min8(uint8_t a, uint8_t b) {
+	return (a < b) ? a : b;
+}
+
+/*
+* Converts colors [first, last) to bytes in the color order of the strip
+* and hands them to backend to encode into buffer. The white byte follows
+* the colors on strips with a white channel. With white extraction the part
+* all three colors have in common is moved to the white LED, after gamma
+* and brightness so the light output stays the same. Returns true if any of
+* the colors can only be shown by dithering.
+*/
+bool WS2812FX_encode(const ws2812fx_encoder_t *encoder, const ws2812fx_backend_t *backend, void *output, void *buffer,
+		const uint32_t *colors, uint16_t first, uint16_t last, uint8_t threshold) {
+	uint8_t bytes[ENCODE_PIXELS * MAX_BYTES_PER_PIXEL];
+	const uint8_t *shifts = encoder->shifts;
+	bool rgbw = encoder->bytes_per_pixel == 4;
+	uint16_t fraction = 0;
+
+	while (first < last) {
+		uint16_t count = (last - first < ENCODE_PIXELS) ? last - first : ENCODE_PIXELS;
+		uint8_t *byte = bytes;
+		for (uint16_t i = first; i < first + count; i++) {
+			uint32_t c = colors[i];
+			uint8_t c0 = WS2812FX_output(encoder, c >> shifts[0], threshold, &fraction);
+			uint8_t c1 = WS2812FX_output(encoder, c >> shifts[1], threshold, &fraction);
+			uint8_t c2 = WS2812FX_output(encoder, c >> shifts[2], threshold, &fraction);
+
+			if (rgbw) {
+				uint8_t w = WS2812FX_output(encoder, c >> 24, threshold, &fraction);
+				if (encoder->white_extraction) {
+					uint8_t common = WS2812FX_min8(WS2812FX_min8(c0, c1), c2);
+					c0 -= common;
+					c1 -= common;
+					c2 -= common;
+					w = (w + common > 255) ? 255 : w + common;
+				}
+				*byte++ = c0;
+				*byte++ = c1;
+				*byte++ = c2;
+				*byte++ = w;
+			} else {
+				*byte++ = c0;
+				*byte++ = c1;
+				*byte++ = c2;
+			}
+		}
+		backend->encode(output, buffer, first * encoder->bytes_per_pixel, bytes, count * encoder->bytes_per_pixel);
+		first += count;
+	}
+	return (fraction & 0xFF) != 0;
+}
+
+/*
+* SPI pattern of one byte: every bit becomes 100 for a 0 and 110 for a 1,
+* MSB first, in the low 24 bits. The table is built by the compiler and
+* stays in flash.
+*/
+#define SPI_BIT(v, n) ((((v) >> (n)) & 1) ? 6u : 4u)
+#define SPI_CODE(v) ( \
+	(SPI_BIT(v, 7) << 21) | (SPI_BIT(v, 6) << 18) | (SPI_BIT(v, 5) << 15) | (SPI_BIT(v, 4) << 12) | \
+	(SPI_BIT(v, 3) << 9) | (SPI_BIT(v, 2) << 6) | (SPI_BIT(v, 1) << 3) | SPI_BIT(v, 0))
+#define SPI_CODES_4(v) SPI_CODE(v), SPI_CODE(v + 1), SPI_CODE(v + 2), SPI_CODE(v + 3)
+#define SPI_CODES_16(v) SPI_CODES_4(v), SPI_CODES_4(v + 4), SPI_CODES_4(v + 8), SPI_CODES_4(v + 12)
+#define SPI_CODES_64(v) SPI_CODES_16(v), SPI_CODES_16(v + 16), SPI_CODES_16(v + 32), SPI_CODES_16(v + 48)
+
+static const uint32_t spi_codes[256] = {
+	SPI_CODES_64(0), SPI_CODES_64(64), SPI_CODES_64(128), SPI_CODES_64(192)
+};
+
+/*
+* Encodes count bytes into 3 * count bytes of SPI patterns.
+*/
+void WS2812FX_spiEncode(uint8_t *out, const uint8_t *bytes, uint32_t count) {
+	for (uint32_t i = 0; i < count; i++) {
+		uint32_t code = spi_codes[bytes[i]];
+		*out++ = code >> 16;
+		*out++ = code >> 8;
+		*out++ = code;
+	}
+}
+
+static void *WS2812FX_memoryOpen(const ws2812fx_output_config_t *config) {
+	ws2812fx_memory_output_t *output = calloc(1, sizeof(ws2812fx_memory_output_t));
+	if (output) {
+		output->config = *config;
+	}
+	return output;
+}
+
+static void *WS2812FX_memoryAlloc(void *output) {
+	const ws2812fx_memory_output_t *memory = output;
+	return calloc(memory->config.length, memory->config.bytes_per_pixel);
+}
+
+static void WS2812FX_memoryEncode(void *output, void *buffer, uint32_t offset, const uint8_t *bytes, uint32_t count) {
+	(void)output;
+	memcpy((uint8_t *)buffer + offset, bytes, count);
+}
+
+static bool WS2812FX_memorySend(void *output, void *buffer) {
+	ws2812fx_memory_output_t *memory = output;
+	memory->latched = buffer;
+	memory->frames++;
+	if (memory->config.done) {
+		memory->config.done(memory->config.done_arg);
+	}
+	return true;
+}
+
+static void WS2812FX_memoryClose(void *output) {
+	free(output);
+}
+
+const ws2812fx_backend_t WS2812FX_BACKEND_MEMORY = {
+	.name = "memory",
+	.open = WS2812FX_memoryOpen,
+	.alloc = WS2812FX_memoryAlloc,
+	.encode = WS2812FX_memoryEncode,
+	.send = WS2812FX_memorySend,
+	.synchronize = NULL,
+	.close = WS2812FX_memoryClose
+};
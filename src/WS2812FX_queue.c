@@ -0,0 +1,114 @@
+/*
+WS2812FX_queue.c - Lock-free command queues for WS2812FX.
+
+Indices run freely and wrap at 2^32, slots are picked with the low bits.
+All queues are valid when zeroed, so static ones need no init call.
+
+LICENSE
+The MIT License (MIT), see WS2812FX.h
+*/
+
+#include "WS2812FX_queue.h"
+
+#define QUEUE_MASK (WS2812FX_QUEUE_LENGTH - 1)
+
+void WS2812FX_spscInit(ws2812fx_spsc_queue_t *queue) {
+	atomic_init(&queue->head, 0);
+	atomic_init(&queue->tail, 0);
+}
+
+/*
+* Producer side. Returns false if the queue is full.
+*/
+bool WS2812FX_spscPush(ws2812fx_spsc_queue_t *queue, const ws2812fx_command_t *command) {
+	unsigned int head = atomic_load_explicit(&queue->head, memory_order_relaxed);
+	unsigned int tail = atomic_load_explicit(&queue->tail, memory_order_acquire);
+
+	if (head - tail >= WS2812FX_QUEUE_LENGTH) {
+		return false;
+	}
+	queue->commands[head & QUEUE_MASK] = *command;
+	atomic_store_explicit(&queue->head, head + 1, memory_order_release);
+	return true;
+}
+
+/*
+* Consumer side. Returns false if the queue is empty.
+*/
+bool WS2812FX_spscPop(ws2812fx_spsc_queue_t *queue, ws2812fx_command_t *command) {
+	unsigned int tail = atomic_load_explicit(&queue->tail, memory_order_relaxed);
+	unsigned int head = atomic_load_explicit(&queue->head, memory_order_acquire);
+
+	if (head == tail) {
+		return false;
+	}
+	*command = queue->commands[tail & QUEUE_MASK];
+	atomic_store_explicit(&queue->tail, tail + 1, memory_order_release);
+	return true;
+}
+
+/*
+* Sequence numbers are kept relative to the start of the lap, position
+* pos & ~QUEUE_MASK, so zero marks every slot free for the first lap.
+*/
+static inline unsigned int WS2812FX_lap(unsigned int pos) {
+	return pos & ~QUEUE_MASK;
+}
+
+void WS2812FX_mpscInit(ws2812fx_mpsc_queue_t *queue) {
+	for (unsigned int i = 0; i < WS2812FX_QUEUE_LENGTH; i++) {
+		atomic_init(&queue->slots[i].sequence, 0);
+	}
+	atomic_init(&queue->head, 0);
+	queue->tail = 0;
+}
+
+/*
+* Producer side, may be called from several tasks at once. A slot is free
+* for position pos while its sequence equals the lap of pos. Returns false
+* if the queue is full.
+*/
+bool WS2812FX_mpscPush(ws2812fx_mpsc_queue_t *queue, const ws2812fx_command_t *command) {
+	unsigned int pos = atomic_load_explicit(&queue->head, memory_order_relaxed);
+	ws2812fx_mpsc_slot_t *slot;
+
+	while (true) {
+		slot = &queue->slots[pos & QUEUE_MASK];
+		unsigned int sequence = atomic_load_explicit(&slot->sequence, memory_order_acquire);
+		int diff = (int)(sequence - WS2812FX_lap(pos));
+
+		if (diff == 0) {
+			// on failure pos is reloaded with the current head
+			if (atomic_compare_exchange_weak_explicit(&queue->head, &pos, pos + 1,
+					memory_order_relaxed, memory_order_relaxed)) {
+				break;
+			}
+		} else if (diff < 0) {
+			return false;	// the consumer has not freed this slot yet
+		} else {
+			pos = atomic_load_explicit(&queue->head, memory_order_relaxed);
+		}
+	}
+
+	slot->command = *command;
+	atomic_store_explicit(&slot->sequence, WS2812FX_lap(pos) + 1, memory_order_release);
+	return true;
+}
+
+/*
+* Consumer side. Returns false if the queue is empty or the next command
+* is claimed but not published yet.
+*/
+bool WS2812FX_mpscPop(ws2812fx_mpsc_queue_t *queue, ws2812fx_command_t *command) {
+	unsigned int pos = queue->tail;
+	ws2812fx_mpsc_slot_t *slot = &queue->slots[pos & QUEUE_MASK];
+	unsigned int sequence = atomic_load_explicit(&slot->sequence, memory_order_acquire);
+
+	if ((int)(sequence - (WS2812FX_lap(pos) + 1)) < 0) {
+		return false;
+	}
+	*command = slot->command;
+	atomic_store_explicit(&slot->sequence, WS2812FX_lap(pos) + WS2812FX_QUEUE_LENGTH, memory_order_release);
+	queue->tail = pos + 1;
+	return true;
+}
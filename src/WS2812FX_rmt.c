@@ -0,0 +1,184 @@
+/*
+WS2812FX_rmt.c - RMT output backend for WS2812FX.
+
+Every WS2812 bit is one RMT item, so a frame takes 32 bytes of memory per
+byte sent. Each strip needs its own RMT channel.
+
+LICENSE
+The MIT License (MIT), see WS2812FX.h
+*/
+
+#include "WS2812FX_output.h"
+
+#include <stdlib.h>
+
+#include "driver/rmt.h"
+#include "esp_attr.h"
+#include <esp_log.h>
+
+#define WS2812_T0H_NS						350
+#define WS2812_T0L_NS						1000
+#define WS2812_T1H_NS						1000
+#define WS2812_T1L_NS						350
+#define WS2812_RESET_US						280
+
+static const char *TAG = "ws2812_rmt";
+
+typedef struct {
+	ws2812fx_output_config_t config;
+	uint32_t item_count;		// 8 per byte plus the reset pulse
+	rmt_item32_t bit0;
+	rmt_item32_t bit1;
+	rmt_item32_t reset;
+} ws2812fx_rmt_output_t;
+
+static ws2812fx_rmt_output_t *_rmt_outputs[RMT_CHANNEL_MAX];	// for WS2812FX_rmtDone()
+
+static void IRAM_ATTR WS2812FX_rmtDone(rmt_channel_t channel, void *arg) {
+	(void)arg;
+	ws2812fx_rmt_output_t *rmt = _rmt_outputs[channel];
+	if (rmt) {
+		rmt->config.done(rmt->config.done_arg);
+	}
+}
+
+static void *WS2812FX_rmtOpen(const ws2812fx_output_config_t *config) {
+	if (config->channel >= RMT_CHANNEL_MAX || _rmt_outputs[config->channel]) {
+		ESP_LOGE(TAG, "RMT channel %d not available", config->channel);
+		return NULL;
+	}
+
+	ws2812fx_rmt_output_t *rmt = calloc(1, sizeof(ws2812fx_rmt_output_t));
+	if (!rmt) {
+		ESP_LOGE(TAG, "allocating output failed");
+		return NULL;
+	}
+	rmt->config = *config;
+	rmt->item_count = (config->length * config->bytes_per_pixel * 8) + 1;
+
+	rmt_config_t channel_config = RMT_DEFAULT_CONFIG_TX(config->gpio, config->channel);
+	// set counter clock to 40MHz
+	channel_config.clk_div = 2;
+
+	esp_err_t err = rmt_config(&channel_config);
+	if (err != ESP_OK) {
+		ESP_LOGE(TAG, "configuring RMT channel %d failed: %s", config->channel, esp_err_to_name(err));
+		free(rmt);
+		return NULL;
+	}
+	err = rmt_driver_install(channel_config.channel, 0, 0);
+	if (err != ESP_OK) {
+		ESP_LOGE(TAG, "installing RMT channel %d failed: %s", config->channel, esp_err_to_name(err));
+		free(rmt);
+		return NULL;
+	}
+
+	uint32_t counter_clk_hz = 0;
+	err = rmt_get_counter_clock(channel_config.channel, &counter_clk_hz);
+	if (err != ESP_OK) {
+		ESP_LOGE(TAG, "reading the clock of RMT channel %d failed: %s", config->channel, esp_err_to_name(err));
+		rmt_driver_uninstall(channel_config.channel);
+		free(rmt);
+		return NULL;
+	}
+	float ratio = (float)counter_clk_hz / 1e9;
+
+	rmt->bit0.level0 = 1;
+	rmt->bit0.duration0 = ratio * WS2812_T0H_NS;
+	rmt->bit0.level1 = 0;
+	rmt->bit0.duration1 = ratio * WS2812_T0L_NS;
+	rmt->bit1.level0 = 1;
+	rmt->bit1.duration0 = ratio * WS2812_T1H_NS;
+	rmt->bit1.level1 = 0;
+	rmt->bit1.duration1 = ratio * WS2812_T1L_NS;
+
+	// hold the line low after the last bit so the strip latches the frame
+	rmt->reset.level0 = 0;
+	rmt->reset.duration0 = ratio * WS2812_RESET_US * 1000;
+	rmt->reset.level1 = 0;
+	rmt->reset.duration1 = 0;
+
+	static bool callback_registered = false;
+	if (!callback_registered) {
+		rmt_register_tx_end_callback(WS2812FX_rmtDone, NULL);
+		callback_registered = true;
+	}
+	_rmt_outputs[config->channel] = rmt;
+	return rmt;
+}
+
+static void *WS2812FX_rmtAlloc(void *output) {
+	const ws2812fx_rmt_output_t *rmt = output;
+	rmt_item32_t *items = malloc(rmt->item_count * sizeof(rmt_item32_t));
+	if (!items) {
+		return NULL;
+	}
+
+	for (uint32_t i = 0; i < rmt->item_count - 1; i++) {
+		items[i] = rmt->bit0;
+	}
+	items[rmt->item_count - 1] = rmt->reset;
+	return items;
+}
+
+/*
+* Encodes every byte MSB first into 8 RMT items.
+*/
+static void WS2812FX_rmtEncode(void *output, void *buffer, uint32_t offset, const uint8_t *bytes, uint32_t count) {
+	const ws2812fx_rmt_output_t *rmt = output;
+	rmt_item32_t *item = (rmt_item32_t *)buffer + (offset * 8);
+
+	for (uint32_t i = 0; i < count; i++) {
+		uint8_t value = bytes[i];
+		for (uint8_t mask = 0x80; mask; mask >>= 1) {
+			*item++ = (value & mask) ? rmt->bit1 : rmt->bit0;
+		}
+	}
+}
+
+static bool WS2812FX_rmtSend(void *output, void *buffer) {
+	const ws2812fx_rmt_output_t *rmt = output;
+	esp_err_t err = rmt_write_items(rmt->config.channel, buffer, rmt->item_count, false);
+	if (err != ESP_OK) {
+		ESP_LOGE(TAG, "sending on RMT channel %d failed: %s", rmt->config.channel, esp_err_to_name(err));
+		return false;
+	}
+	return true;
+}
+
+#if SOC_RMT_SUPPORT_TX_SYNCHRO
+/*
+* Adds the channel to the RMT sync group, the channels of the group start
+* on the same clock once all of them have been written.
+*/
+static bool WS2812FX_rmtSynchronize(void *output) {
+	const ws2812fx_rmt_output_t *rmt = output;
+	esp_err_t err = rmt_add_channel_to_group(rmt->config.channel);
+	if (err != ESP_OK) {
+		ESP_LOGE(TAG, "synchronizing RMT channel %d failed: %s", rmt->config.channel, esp_err_to_name(err));
+		return false;
+	}
+	return true;
+}
+#endif
+
+static void WS2812FX_rmtClose(void *output) {
+	ws2812fx_rmt_output_t *rmt = output;
+	rmt_driver_uninstall(rmt->config.channel);
+	_rmt_outputs[rmt->config.channel] = NULL;
+	free(rmt);
+}
+
+const ws2812fx_backend_t WS2812FX_BACKEND_RMT = {
+	.name = "rmt",
+	.open = WS2812FX_rmtOpen,
+	.alloc = WS2812FX_rmtAlloc,
+	.encode = WS2812FX_rmtEncode,
+	.send = WS2812FX_rmtSend,
+#if SOC_RMT_SUPPORT_TX_SYNCHRO
+	.synchronize = WS2812FX_rmtSynchronize,
+#else
+	.synchronize = NULL,
+#endif
+	.close = WS2812FX_rmtClose
+};
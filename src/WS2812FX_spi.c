@@ -0,0 +1,154 @@
+/*
+WS2812FX_spi.c - SPI DMA output backend for WS2812FX.
+
+Every WS2812 bit is sent as WS2812FX_SPI_BITS_PER_BIT bits on MOSI, so a
+frame takes 3 bytes of DMA memory per byte sent instead of the 32 of the
+RMT backend, and the CPU only looks the patterns up in a table. Long
+strips fit in memory and the RMT channels stay free. Each strip needs its
+own SPI host, the channel of the config selects it.
+
+LICENSE
+The MIT License (MIT), see WS2812FX.h
+*/
+
+#include "WS2812FX_output.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "driver/spi_master.h"
+#include "esp_heap_caps.h"
+#include "esp_attr.h"
+#include <esp_log.h>
+
+#define WS2812_RESET_US						280
+// low bits after the frame so the strip latches it
+#define WS2812_SPI_RESET_BYTES				((WS2812_RESET_US * (WS2812FX_SPI_CLOCK_HZ / 1000)) / 8000 + 1)
+
+static const char *TAG = "ws2812_spi";
+
+typedef struct {
+	ws2812fx_output_config_t config;
+	spi_device_handle_t device;
+	spi_transaction_t transaction;
+	uint32_t size;				// bytes of a frame buffer including the reset
+} ws2812fx_spi_output_t;
+
+static void IRAM_ATTR WS2812FX_spiDone(spi_transaction_t *transaction) {
+	ws2812fx_spi_output_t *spi = transaction->user;
+	spi->config.done(spi->config.done_arg);
+}
+
+/*
+* SPI1 carries the flash, only the general purpose hosts can drive a strip.
+*/
+static bool WS2812FX_spiHostValid(uint8_t host) {
+#if SOC_SPI_PERIPH_NUM > 2
+	if (host == SPI3_HOST) {
+		return true;
+	}
+#endif
+	return host == SPI2_HOST;
+}
+
+static void *WS2812FX_spiOpen(const ws2812fx_output_config_t *config) {
+	if (!WS2812FX_spiHostValid(config->channel)) {
+		ESP_LOGE(TAG, "SPI host %d: %s", config->channel, esp_err_to_name(ESP_ERR_INVALID_ARG));
+		return NULL;
+	}
+
+	ws2812fx_spi_output_t *spi = calloc(1, sizeof(ws2812fx_spi_output_t));
+	if (!spi) {
+		ESP_LOGE(TAG, "allocating output failed");
+		return NULL;
+	}
+	spi->config = *config;
+	spi->size = (config->length * config->bytes_per_pixel * WS2812FX_SPI_BITS_PER_BIT) + WS2812_SPI_RESET_BYTES;
+
+	spi_bus_config_t bus_config = {
+		.mosi_io_num = config->gpio,
+		.miso_io_num = -1,
+		.sclk_io_num = -1,
+		.quadwp_io_num = -1,
+		.quadhd_io_num = -1,
+		.max_transfer_sz = spi->size
+	};
+	spi_device_interface_config_t device_config = {
+		.mode = 0,
+		.clock_speed_hz = WS2812FX_SPI_CLOCK_HZ,
+		.spics_io_num = -1,
+		.queue_size = 1,
+		.post_cb = WS2812FX_spiDone
+	};
+
+	if (spi_bus_initialize(config->channel, &bus_config, SPI_DMA_CH_AUTO) != ESP_OK) {
+		ESP_LOGE(TAG, "SPI host %d not available", config->channel);
+		free(spi);
+		return NULL;
+	}
+	if (spi_bus_add_device(config->channel, &device_config, &spi->device) != ESP_OK) {
+		ESP_LOGE(TAG, "adding device to SPI host %d failed", config->channel);
+		spi_bus_free(config->channel);
+		free(spi);
+		return NULL;
+	}
+	return spi;
+}
+
+static void *WS2812FX_spiAlloc(void *output) {
+	const ws2812fx_spi_output_t *spi = output;
+	uint8_t *buffer = heap_caps_malloc(spi->size, MALLOC_CAP_DMA);
+	if (!buffer) {
+		return NULL;
+	}
+
+	static const uint8_t black = 0;
+	uint32_t bytes = spi->config.length * spi->config.bytes_per_pixel;
+	for (uint32_t i = 0; i < bytes; i++) {
+		WS2812FX_spiEncode(&buffer[i * WS2812FX_SPI_BITS_PER_BIT], &black, 1);
+	}
+	memset(&buffer[bytes * WS2812FX_SPI_BITS_PER_BIT], 0, WS2812_SPI_RESET_BYTES);
+	return buffer;
+}
+
+static void WS2812FX_spiEncodeFrame(void *output, void *buffer, uint32_t offset, const uint8_t *bytes, uint32_t count) {
+	(void)output;
+	WS2812FX_spiEncode((uint8_t *)buffer + (offset * WS2812FX_SPI_BITS_PER_BIT), bytes, count);
+}
+
+static bool WS2812FX_spiSend(void *output, void *buffer) {
+	ws2812fx_spi_output_t *spi = output;
+
+	// the previous frame is latched, take its result so the queue has room
+	spi_transaction_t *done;
+	while (spi_device_get_trans_result(spi->device, &done, 0) == ESP_OK) {
+	}
+
+	memset(&spi->transaction, 0, sizeof(spi->transaction));
+	spi->transaction.length = spi->size * 8;
+	spi->transaction.tx_buffer = buffer;
+	spi->transaction.user = spi;
+	esp_err_t err = spi_device_queue_trans(spi->device, &spi->transaction, portMAX_DELAY);
+	if (err != ESP_OK) {
+		ESP_LOGE(TAG, "sending on SPI host %d failed: %s", spi->config.channel, esp_err_to_name(err));
+		return false;
+	}
+	return true;
+}
+
+static void WS2812FX_spiClose(void *output) {
+	ws2812fx_spi_output_t *spi = output;
+	spi_bus_remove_device(spi->device);
+	spi_bus_free(spi->config.channel);
+	free(spi);
+}
+
+const ws2812fx_backend_t WS2812FX_BACKEND_SPI = {
+	.name = "spi",
+	.open = WS2812FX_spiOpen,
+	.alloc = WS2812FX_spiAlloc,
+	.encode = WS2812FX_spiEncodeFrame,
+	.send = WS2812FX_spiSend,
+	.synchronize = NULL,
+	.close = WS2812FX_spiClose
+};